@@ -0,0 +1,446 @@
+// Decoder micro-benchmarks for the Microstrain 3DM-GX3-25 driver
+//
+// Runs on a synthetic 0xCC stream by default. Set IMU_3DM_GX3_BENCH_LOG
+// to a raw log written with the capture_file param to benchmark the
+// framing on recorded data instead.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <imu_3dm_gx3/decode.h>
+#include <imu_3dm_gx3/frame_parser.h>
+#include <imu_3dm_gx3/message_pool.h>
+#include <imu_3dm_gx3/orientation.h>
+#include <imu_3dm_gx3/orientation_filter.h>
+#include <imu_3dm_gx3/preintegration.h>
+#include <imu_3dm_gx3/presets.h>
+#include <imu_3dm_gx3/raw_log.h>
+
+using namespace imu_3dm_gx3;
+
+// Every heap allocation in the process, for the message benchmarks. All
+// forms of new and delete are replaced, arrays included. They go through
+// out of line helpers: GCC 12 otherwise inlines the replacements into
+// the callers and warns about free() on memory from operator new
+// (-Wmismatched-new-delete), although both are ours.
+static std::atomic<unsigned long> heap_allocations(0);
+
+__attribute__((noinline)) static void *counted_alloc(size_t size)
+{
+  heap_allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+__attribute__((noinline)) static void counted_free(void *p)
+{
+  free(p);
+}
+
+void *operator new(size_t size)
+{
+  return counted_alloc(size);
+}
+
+void *operator new[](size_t size)
+{
+  return counted_alloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+  counted_free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+  counted_free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  counted_free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+  counted_free(p);
+}
+
+namespace
+{
+
+void encode_float(float f, unsigned char *dst)
+{
+  uint32_t v;
+  memcpy(&v, &f, 4);
+  encode_be32(v, dst);
+}
+
+// One 0xCC frame with plausible content and a valid checksum
+void make_frame(unsigned int n, unsigned char *frame)
+{
+  const Preset &preset = *find_preset(0xCC);
+  frame[0] = preset.command;
+  unsigned char *p = frame + 1;
+  for (int i = 0; i < 3; i++, p += 4)
+    encode_float(i == 2 ? -1.0f : 0.01f * i, p);
+  for (int i = 0; i < 3; i++, p += 4)
+    encode_float(0.001f * (n % 100), p);
+  for (int i = 0; i < 3; i++, p += 4)
+    encode_float(0.3f, p);
+  for (int i = 0; i < 9; i++, p += 4)
+    encode_float(i % 4 == 0 ? 1.0f : 0.0f, p);
+  encode_be32(n * 62, p);
+
+  unsigned short chksum = 0;
+  for (size_t i = 0; i < preset.length - 2; i++)
+    chksum += frame[i];
+  encode_be16(chksum, frame + preset.length - 2);
+}
+
+// Stream of 'frames' frames. 'corruption' is the probability per byte that
+// the byte is flipped or dropped.
+std::vector<unsigned char> make_stream(unsigned int frames, double corruption)
+{
+  const size_t length = find_preset(0xCC)->length;
+  std::vector<unsigned char> stream;
+  stream.reserve(frames * length);
+
+  srand(1);
+  unsigned char frame[MAX_FRAME_LENGTH];
+  for (unsigned int n = 0; n < frames; n++)
+    {
+      make_frame(n, frame);
+      for (size_t i = 0; i < length; i++)
+        {
+          if (corruption > 0.0 && rand() < corruption * RAND_MAX)
+            {
+              if (rand() % 2)
+                continue;
+              stream.push_back(frame[i] ^ 0x5A);
+            }
+          else
+            stream.push_back(frame[i]);
+        }
+    }
+  return stream;
+}
+
+std::vector<unsigned char> load_stream(unsigned char &preset)
+{
+  std::vector<unsigned char> stream;
+  const char *path = getenv("IMU_3DM_GX3_BENCH_LOG");
+  RawLogReader log;
+  if (!path || !log.open(path))
+    return stream;
+
+  preset = log.header().preset;
+  int64_t received;
+  const unsigned char *data;
+  uint32_t length;
+  while (log.next(received, data, length))
+    stream.insert(stream.end(), data, data + length);
+  return stream;
+}
+
+}
+
+static void BM_ValidateChecksum(benchmark::State &state)
+{
+  unsigned char frame[MAX_FRAME_LENGTH];
+  make_frame(0, frame);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validate_checksum(frame, 79));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ValidateChecksum);
+
+static void BM_DecodeFrame(benchmark::State &state)
+{
+  const Preset &preset = *find_preset(0xCC);
+  unsigned char frame[MAX_FRAME_LENGTH];
+  make_frame(0, frame);
+  Sample sample = Sample();
+  for (auto _ : state)
+    {
+      decode_frame(preset, frame, sample);
+      benchmark::DoNotOptimize(sample);
+    }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DecodeFrame);
+
+static void BM_MatrixToQuaternion(benchmark::State &state)
+{
+  const Preset &preset = *find_preset(0xCC);
+  unsigned char frame[MAX_FRAME_LENGTH];
+  make_frame(0, frame);
+  Sample sample = Sample();
+  decode_frame(preset, frame, sample);
+  double q[4];
+  for (auto _ : state)
+    {
+      benchmark::DoNotOptimize(sample.M);
+      matrix_to_quaternion(sample.M, q);
+      benchmark::DoNotOptimize(q);
+    }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MatrixToQuaternion);
+
+// The same orientation from 0xCE/0xCF Euler angles
+static void BM_EulerToQuaternion(benchmark::State &state)
+{
+  float euler[3] = {0.1f, -0.2f, 1.5f};
+  double q[4];
+  for (auto _ : state)
+    {
+      benchmark::DoNotOptimize(euler);
+      euler_to_quaternion(euler, q);
+      benchmark::DoNotOptimize(q);
+    }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EulerToQuaternion);
+
+// One preintegration step with covariance and bias Jacobians, the host
+// cost per sample of the imu_preintegrated topic
+static void BM_Preintegrate(benchmark::State &state)
+{
+  Preintegrator preint(5.2e-4, 7.8e-4);
+  double w[3] = {0.1, -0.2, 0.3};
+  double a[3] = {0.5, 0.1, 9.8};
+  for (auto _ : state)
+    {
+      benchmark::DoNotOptimize(w);
+      preint.integrate(w, a, 0.001);
+      if (preint.samples() == 1000)
+        preint.reset();
+    }
+  benchmark::DoNotOptimize(preint.covariance());
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Preintegrate);
+
+// One orientation filter step with magnetometer, the host cost per
+// sample of the imu_fused topic. The argument selects the method.
+static void BM_OrientationFilter(benchmark::State &state)
+{
+  OrientationFilter filter((OrientationFilter::Method)state.range(0), 0.1);
+  double w[3] = {0.1, -0.2, 0.3};
+  double a[3] = {0.5, 0.1, 9.8};
+  double m[3] = {0.2, 0.05, -0.4};
+  filter.update(w, a, m, 0.0);
+  for (auto _ : state)
+    {
+      benchmark::DoNotOptimize(w);
+      filter.update(w, a, m, 0.001);
+    }
+  benchmark::DoNotOptimize(filter.quaternion());
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_OrientationFilter)->Arg(OrientationFilter::MADGWICK)->Arg(OrientationFilter::COMPLEMENTARY);
+
+// Framing of a whole stream in read sized chunks. The argument is the
+// byte corruption rate in parts per million.
+static void BM_ParseStream(benchmark::State &state)
+{
+  const Preset &preset = *find_preset(0xCC);
+  std::vector<unsigned char> stream = make_stream(10000, state.range(0) * 1e-6);
+  const size_t chunk = 256;
+  unsigned char frame[MAX_FRAME_LENGTH];
+  unsigned long frames = 0;
+
+  for (auto _ : state)
+    {
+      FrameParser parser(preset.command, preset.length);
+      for (size_t i = 0; i < stream.size(); i += chunk)
+        {
+          parser.feed(&stream[i], std::min(chunk, stream.size() - i));
+          while (parser.next(frame))
+            frames++;
+        }
+    }
+  state.SetItemsProcessed(frames);
+  state.SetBytesProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(BM_ParseStream)->Arg(0)->Arg(100)->Arg(1000)->Arg(10000);
+
+// Framing a clean stream handed over in reads of the given size, with the
+// ring sized for it the way the driver sizes it from read_chunk
+static void BM_ReadChunk(benchmark::State &state)
+{
+  const Preset &preset = *find_preset(0xCC);
+  std::vector<unsigned char> stream = make_stream(10000, 0.0);
+  const size_t chunk = state.range(0);
+  unsigned char frame[MAX_FRAME_LENGTH];
+  unsigned long frames = 0;
+
+  for (auto _ : state)
+    {
+      FrameParser parser(preset.command, preset.length, 2 * chunk);
+      for (size_t i = 0; i < stream.size(); i += chunk)
+        {
+          parser.feed(&stream[i], std::min(chunk, stream.size() - i));
+          while (parser.next(frame))
+            frames++;
+        }
+    }
+  state.SetItemsProcessed(frames);
+  state.SetBytesProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(BM_ReadChunk)->Arg(16)->Arg(79)->Arg(256)->Arg(1024)->Arg(4096);
+
+// Framing, decode and orientation conversion per frame, the host side
+// work of the streaming loop short of building messages
+static void BM_Pipeline(benchmark::State &state)
+{
+  const Preset &preset = *find_preset(0xCC);
+  std::vector<unsigned char> stream = make_stream(10000, state.range(0) * 1e-6);
+  const size_t chunk = 256;
+  unsigned char frame[MAX_FRAME_LENGTH];
+  Sample sample = Sample();
+  double q[4];
+  unsigned long frames = 0;
+
+  for (auto _ : state)
+    {
+      FrameParser parser(preset.command, preset.length);
+      for (size_t i = 0; i < stream.size(); i += chunk)
+        {
+          parser.feed(&stream[i], std::min(chunk, stream.size() - i));
+          while (parser.next(frame))
+            {
+              decode_frame(preset, frame, sample);
+              matrix_to_quaternion(sample.M, q);
+              benchmark::DoNotOptimize(q);
+              frames++;
+            }
+        }
+    }
+  state.SetItemsProcessed(frames);
+  state.SetBytesProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(BM_Pipeline)->Arg(0)->Arg(1000);
+
+// Framing of a recorded raw log, skipped without IMU_3DM_GX3_BENCH_LOG
+static void BM_ParseRecorded(benchmark::State &state)
+{
+  unsigned char command = 0;
+  std::vector<unsigned char> stream = load_stream(command);
+  const Preset *preset = find_preset(command);
+  if (stream.empty() || !preset)
+    {
+      state.SkipWithError("IMU_3DM_GX3_BENCH_LOG not set or unreadable");
+      return;
+    }
+
+  const size_t chunk = 256;
+  unsigned char frame[MAX_FRAME_LENGTH];
+  unsigned long frames = 0;
+  for (auto _ : state)
+    {
+      FrameParser parser(preset->command, preset->length);
+      for (size_t i = 0; i < stream.size(); i += chunk)
+        {
+          parser.feed(&stream[i], std::min(chunk, stream.size() - i));
+          while (parser.next(frame))
+            frames++;
+        }
+    }
+  state.SetItemsProcessed(frames);
+  state.SetBytesProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(BM_ParseRecorded);
+
+// Stand-in for sensor_msgs/Imu with the same layout of fields, so the
+// benchmark does not need ROS
+struct ImuMessage
+{
+  struct
+  {
+    uint32_t seq;
+    double stamp;
+    std::string frame_id;
+  } header;
+  double orientation[4];
+  double orientation_covariance[9];
+  double angular_velocity[3];
+  double angular_velocity_covariance[9];
+  double linear_acceleration[3];
+  double linear_acceleration_covariance[9];
+};
+
+void fill_message(ImuMessage &msg, unsigned long n)
+{
+  msg.header.stamp = n * 1e-3;
+  for (int i = 0; i < 3; i++)
+    {
+      msg.angular_velocity[i] = 0.01 * i;
+      msg.linear_acceleration[i] = 9.8 * i;
+    }
+}
+
+void init_message(const std::string &frame_id, ImuMessage &msg)
+{
+  msg.header.frame_id = frame_id;
+  for (int i = 0; i < 9; i++)
+    msg.orientation_covariance[i] = msg.angular_velocity_covariance[i] =
+      msg.linear_acceleration_covariance[i] = i % 4 == 0 ? 1e-4 : 0.0;
+}
+
+// A subscriber holding on to the last few messages it received
+const size_t HELD_MESSAGES = 16;
+
+// A message per sample as the nodelet built them before the pool: new
+// shared message, frame id and covariances copied in. The frame id is too
+// long for the small string buffer, as most real ones are.
+static void BM_FreshMessages(benchmark::State &state)
+{
+  const std::string frame_id = "robot/imu_3dm_gx3_link";
+  std::vector<boost::shared_ptr<ImuMessage> > held(HELD_MESSAGES);
+  unsigned long n = 0;
+  unsigned long before = heap_allocations;
+  for (auto _ : state)
+    {
+      boost::shared_ptr<ImuMessage> msg = boost::make_shared<ImuMessage>();
+      init_message(frame_id, *msg);
+      fill_message(*msg, n);
+      held[n++ % HELD_MESSAGES] = msg;
+    }
+  state.counters["allocs_per_msg"] = benchmark::Counter(heap_allocations - before,
+                                                        benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FreshMessages);
+
+// The same from a MessagePool, as the nodelet publishes now
+static void BM_PooledMessages(benchmark::State &state)
+{
+  const std::string frame_id = "robot/imu_3dm_gx3_link";
+  MessagePool<ImuMessage> pool;
+  pool.reset(256, std::bind(&init_message, frame_id, std::placeholders::_1));
+  std::vector<boost::shared_ptr<ImuMessage> > held(HELD_MESSAGES);
+  unsigned long n = 0;
+  unsigned long before = heap_allocations;
+  for (auto _ : state)
+    {
+      boost::shared_ptr<ImuMessage> msg = pool.acquire();
+      fill_message(*msg, n);
+      held[n++ % HELD_MESSAGES] = msg;
+    }
+  state.counters["allocs_per_msg"] = benchmark::Counter(heap_allocations - before,
+                                                        benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PooledMessages);
+
+BENCHMARK_MAIN();
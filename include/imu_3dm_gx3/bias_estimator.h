@@ -0,0 +1,53 @@
+// Static gyro bias estimation for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#ifndef IMU_3DM_GX3_BIAS_ESTIMATOR_H
+#define IMU_3DM_GX3_BIAS_ESTIMATOR_H
+
+namespace imu_3dm_gx3
+{
+
+// Averages the angular rate over 'duration' seconds while the device is
+// at rest. The window is cut into 'chunk' second pieces; a chunk whose
+// mean differs from the mean so far by more than 'threshold' rad/s on any
+// axis is taken as motion and the window starts over from it. Comparing
+// chunk means rather than single samples keeps the test clear of the
+// sample noise.
+class StaticBiasEstimator
+{
+public:
+  StaticBiasEstimator(double duration = 0.0, double threshold = 0.01,
+                      double chunk = 0.1);
+
+  void reset();
+
+  // Add a sample at time 't' (s). Returns true once, when the estimate
+  // has just become available.
+  bool update(double t, const double *ang_vel);
+
+  bool done() const { return done_; }
+  const double *bias() const { return bias_; }
+  // Windows started over because of motion
+  unsigned long restarts() const { return restarts_; }
+
+private:
+  double duration_;
+  double threshold_;
+  double chunk_;
+
+  bool started_;
+  double start_;
+  double chunk_start_;
+  double sum_[3];
+  unsigned long count_;
+  double chunk_sum_[3];
+  unsigned long chunk_count_;
+
+  bool done_;
+  double bias_[3];
+  unsigned long restarts_;
+};
+
+}
+
+#endif
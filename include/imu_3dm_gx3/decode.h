@@ -0,0 +1,128 @@
+// Payload encoding and decoding for the Microstrain 3DM-GX3-25 single byte protocol
+// N. Michael
+
+#ifndef IMU_3DM_GX3_DECODE_H
+#define IMU_3DM_GX3_DECODE_H
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <imu_3dm_gx3/presets.h>
+
+namespace imu_3dm_gx3
+{
+
+// Convert 'count' consecutive big-endian 32 bit words into host order.
+// Going through memcpy keeps this free of aliasing and alignment issues,
+// and the swap loop is simple enough for the compiler to vectorize.
+inline void decode_be32(const unsigned char *src, size_t count, uint32_t *dst)
+{
+  memcpy(dst, src, count * sizeof(uint32_t));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  for (size_t i = 0; i < count; i++)
+    dst[i] = __builtin_bswap32(dst[i]);
+#endif
+}
+
+inline uint16_t decode_be16(const unsigned char *src)
+{
+  return (uint16_t)((src[0] << 8) | src[1]);
+}
+
+inline uint32_t decode_be32(const unsigned char *src)
+{
+  uint32_t v;
+  decode_be32(src, 1, &v);
+  return v;
+}
+
+inline void encode_be16(uint16_t v, unsigned char *dst)
+{
+  dst[0] = (unsigned char)(v >> 8);
+  dst[1] = (unsigned char)v;
+}
+
+inline void encode_be32(uint32_t v, unsigned char *dst)
+{
+  dst[0] = (unsigned char)(v >> 24);
+  dst[1] = (unsigned char)(v >> 16);
+  dst[2] = (unsigned char)(v >> 8);
+  dst[3] = (unsigned char)v;
+}
+
+// Decoded fields of a data reply. Only the fields carried by the preset
+// the frame was decoded with are filled in.
+struct Sample
+{
+  float accel[3];
+  float ang_vel[3];
+  float mag[3];
+  float M[9];
+  float q[4];
+  float euler[3];
+  float stab_accel[3];
+  float stab_mag[3];
+  uint32_t timer;
+};
+
+// Decode a complete, checksum validated frame laid out as 'preset'
+inline void decode_frame(const Preset &preset, const unsigned char *frame, Sample &out)
+{
+  uint32_t words[MAX_PAYLOAD_WORDS];
+  decode_be32(frame + 1, (preset.length - 3) / sizeof(uint32_t), words);
+
+  if (preset.accel >= 0)
+    memcpy(out.accel, words + preset.accel, sizeof(out.accel));
+  if (preset.ang_vel >= 0)
+    memcpy(out.ang_vel, words + preset.ang_vel, sizeof(out.ang_vel));
+  if (preset.mag >= 0)
+    memcpy(out.mag, words + preset.mag, sizeof(out.mag));
+  if (preset.orientation_matrix >= 0)
+    memcpy(out.M, words + preset.orientation_matrix, sizeof(out.M));
+  if (preset.quaternion >= 0)
+    memcpy(out.q, words + preset.quaternion, sizeof(out.q));
+  if (preset.euler >= 0)
+    memcpy(out.euler, words + preset.euler, sizeof(out.euler));
+  if (preset.stab_accel >= 0)
+    memcpy(out.stab_accel, words + preset.stab_accel, sizeof(out.stab_accel));
+  if (preset.stab_mag >= 0)
+    memcpy(out.stab_mag, words + preset.stab_mag, sizeof(out.stab_mag));
+  out.timer = words[preset.timer];
+}
+
+// Lay the fields of 'in' carried by 'preset' out as a frame, checksum
+// included; the inverse of decode_frame
+inline void encode_frame(const Preset &preset, const Sample &in, unsigned char *frame)
+{
+  uint32_t words[MAX_PAYLOAD_WORDS];
+  if (preset.accel >= 0)
+    memcpy(words + preset.accel, in.accel, sizeof(in.accel));
+  if (preset.ang_vel >= 0)
+    memcpy(words + preset.ang_vel, in.ang_vel, sizeof(in.ang_vel));
+  if (preset.mag >= 0)
+    memcpy(words + preset.mag, in.mag, sizeof(in.mag));
+  if (preset.orientation_matrix >= 0)
+    memcpy(words + preset.orientation_matrix, in.M, sizeof(in.M));
+  if (preset.quaternion >= 0)
+    memcpy(words + preset.quaternion, in.q, sizeof(in.q));
+  if (preset.euler >= 0)
+    memcpy(words + preset.euler, in.euler, sizeof(in.euler));
+  if (preset.stab_accel >= 0)
+    memcpy(words + preset.stab_accel, in.stab_accel, sizeof(in.stab_accel));
+  if (preset.stab_mag >= 0)
+    memcpy(words + preset.stab_mag, in.stab_mag, sizeof(in.stab_mag));
+  words[preset.timer] = in.timer;
+
+  frame[0] = preset.command;
+  for (int i = 0; i <= preset.timer; i++)
+    encode_be32(words[i], frame + 1 + 4 * i);
+
+  uint16_t checksum = 0;
+  for (size_t i = 0; i < preset.length - 2; i++)
+    checksum += frame[i];
+  encode_be16(checksum, frame + preset.length - 2);
+}
+
+}
+
+#endif
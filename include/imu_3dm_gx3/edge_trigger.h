@@ -0,0 +1,52 @@
+// External trigger edges for polling the Microstrain 3DM-GX3-25
+// N. Michael
+
+#ifndef IMU_3DM_GX3_EDGE_TRIGGER_H
+#define IMU_3DM_GX3_EDGE_TRIGGER_H
+
+#include <string>
+#include <stdint.h>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+namespace imu_3dm_gx3
+{
+
+// Waits for edges on a hardware line in a thread of its own and calls
+// back with the host time of each edge (ns since the epoch). 'path' is
+// either a PPS device (/dev/pps*), which delivers the kernel timestamp of
+// the assert edge, or a sysfs GPIO value file whose edge was configured
+// beforehand (echo rising > /sys/class/gpio/gpioN/edge), stamped when the
+// wait returns.
+class EdgeTrigger
+{
+public:
+  typedef boost::function<void (int64_t edge)> Callback;
+
+  EdgeTrigger();
+  ~EdgeTrigger();
+
+  // Returns false with errno set if the line cannot be opened
+  bool start(const std::string &path, const Callback &callback);
+  void stop();
+
+  unsigned long edges() const { return edges_; }
+
+private:
+  EdgeTrigger(const EdgeTrigger &);
+  EdgeTrigger &operator=(const EdgeTrigger &);
+
+  void run_gpio();
+  void run_pps();
+
+  int fd_;
+  Callback callback_;
+  boost::thread thread_;
+  boost::atomic<bool> running_;
+  boost::atomic<unsigned long> edges_;
+};
+
+}
+
+#endif
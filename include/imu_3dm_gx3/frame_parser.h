@@ -0,0 +1,66 @@
+// Streaming frame parser for the Microstrain 3DM-GX3-25 single byte protocol
+// N. Michael
+
+#ifndef IMU_3DM_GX3_FRAME_PARSER_H
+#define IMU_3DM_GX3_FRAME_PARSER_H
+
+#include <cstddef>
+#include <vector>
+
+namespace imu_3dm_gx3
+{
+
+bool validate_checksum(const unsigned char *data, unsigned short length);
+
+// Extracts fixed length frames from a raw byte stream. Bytes are appended
+// to a ring buffer with feed() and complete frames are pulled with next().
+// A frame is accepted only when it starts with the expected header byte and
+// its checksum matches; otherwise the candidate offset is advanced by one
+// byte, so a dropped or corrupted byte costs at most one frame.
+class FrameParser
+{
+public:
+  FrameParser(unsigned char header, size_t frame_length,
+              size_t capacity = 4096);
+
+  // Append raw bytes. If the ring is full the oldest bytes are discarded.
+  void feed(const unsigned char *data, size_t length);
+
+  // Copy the next valid frame into 'frame' (frame_length() bytes).
+  // Returns false when no complete frame is buffered.
+  bool next(unsigned char *frame);
+
+  void reset();
+
+  size_t frame_length() const { return frame_length_; }
+  size_t buffered() const { return size_; }
+
+  unsigned long frames() const { return frames_; }
+  unsigned long checksum_failures() const { return checksum_failures_; }
+  unsigned long resyncs() const { return resyncs_; }
+  unsigned long bytes_discarded() const { return bytes_discarded_; }
+
+private:
+  const unsigned char *candidate(unsigned char *scratch) const;
+  void advance(size_t n);
+  void discard(size_t n);
+
+  unsigned char header_;
+  size_t frame_length_;
+
+  std::vector<unsigned char> ring_;
+  size_t head_;
+  size_t size_;
+
+  // True while bytes are being skipped to find the next frame boundary
+  bool lost_sync_;
+
+  unsigned long frames_;
+  unsigned long checksum_failures_;
+  unsigned long resyncs_;
+  unsigned long bytes_discarded_;
+};
+
+}
+
+#endif
@@ -0,0 +1,327 @@
+// ROS independent driver for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#ifndef IMU_3DM_GX3_GX3_DRIVER_H
+#define IMU_3DM_GX3_GX3_DRIVER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/asio.hpp>
+#include <boost/asio/serial_port.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <imu_3dm_gx3/decode.h>
+#include <imu_3dm_gx3/frame_parser.h>
+#include <imu_3dm_gx3/presets.h>
+#include <imu_3dm_gx3/raw_log.h>
+#include <imu_3dm_gx3/statistics.h>
+
+namespace imu_3dm_gx3
+{
+
+// Device handshake and data streaming for one IMU, without any ROS
+// dependency so it can be linked straight into a control process.
+//
+// open() runs the blocking handshake: stop continuous mode, switch to
+// active mode, optionally change the sampling settings, capture the gyro
+// bias and change the link speed, select the preset, start continuous
+// output and reset the device timer. start()
+// then reads the stream asynchronously on the given io_service; every
+// complete frame is handed to the frame and sample callbacks from the
+// io_service thread, so they should return quickly.
+//
+// All handlers of one driver run through its strand, so several drivers
+// can share an io_service that is run from a pool of threads. Code that
+// touches the driver from a handler of its own should go through strand()
+// as well.
+//
+// Handshake reads time out after handshake_timeout. With quick_start a
+// device that is already streaming the wanted preset and rate is left as
+// it is. With reconnect a read error or a silent device closes the port
+// and the handshake is retried in the background with exponential
+// backoff, so an unplugged or browned out device comes back on its own.
+//
+// In polled mode the device is left in active mode instead of continuous
+// output and every poll() asks it for one sample, e.g. on a camera
+// trigger, so that samples line up with external events.
+//
+// Instead of a device, open_replay() feeds a raw log through the same
+// callbacks. open_capture() records everything read from the port.
+//
+// Host times are nanoseconds since the epoch, the clock ros::Time::now()
+// uses outside simulation.
+class Gx3Driver
+{
+public:
+  struct Config
+  {
+    Config();
+
+    std::string port;
+    int baud;
+    // Link speed and output rate to negotiate, zero leaves the device
+    // setting untouched
+    int target_baud;
+    int rate;
+    unsigned char preset;
+    // Warn when nothing was read for this long (s)
+    double read_timeout;
+    // Reset the device timer at the end of open(). Turn off to reset
+    // several devices together with reset_timers().
+    bool reset_timer;
+    // Give up on a handshake reply after this long (s)
+    double handshake_timeout;
+    // Skip the configuration when the device already streams the preset
+    // at the rate. Filter settings and a gyro bias capture still to do
+    // cannot be told from the stream, so they always configure.
+    bool quick_start;
+    // Reconnect after read errors and silence, waiting reconnect_delay
+    // before the first attempt and doubling up to reconnect_max_delay
+    bool reconnect;
+    double reconnect_delay;
+    double reconnect_max_delay;
+    // Ask the serial driver to hand over bytes immediately instead of
+    // batching them (ASYNC_LOW_LATENCY)
+    bool low_latency;
+    // Termios VMIN/VTIME while streaming; -1 uses the frame length of the
+    // preset. Only readiness honours them, the non-blocking reads asio
+    // issues right after a handler still return whatever is buffered, so
+    // whether this saves wakeups depends on the serial driver.
+    int vmin;
+    int vtime;
+    // Bytes asked for per read. Each read returns whatever is buffered up
+    // to this, and every complete frame in it is handled before the next
+    // read, so a backlog is drained in few system calls.
+    int read_chunk;
+    // Only send a sample when poll() asks for one
+    bool polled;
+    // On-device filtering: digital filter windows of the gyros and
+    // accelerometers and of the magnetometer (samples, 1-32) and coning &
+    // sculling compensation (0 off, 1 on). 0, or -1 for coning_sculling,
+    // leaves the device setting untouched.
+    int filter_window;
+    int mag_filter_window;
+    int coning_sculling;
+    // Have the device capture its gyro bias over this long (s) during the
+    // first handshake; it has to be at rest meanwhile. 0 skips it.
+    double capture_gyro_bias;
+    // Store the sampling settings and link speed in EEPROM, so that the
+    // device boots with them. The first start of a process stores them
+    // even if they are already in effect, since they may only have been
+    // set by a run without persist; later starts and reconnects of the
+    // same process probe the stored link speed first and write nothing
+    // that matches. The preset and continuous mode are not stored and are
+    // set on every start.
+    bool persist;
+  };
+
+  enum LogLevel
+  {
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+  };
+
+  typedef boost::function<void (const unsigned char *frame, int64_t received)> FrameCallback;
+  typedef boost::function<void (const Sample &sample, int64_t received)> SampleCallback;
+  typedef boost::function<void (LogLevel level, const std::string &message)> LogCallback;
+  typedef boost::function<void ()> StopCallback;
+
+  explicit Gx3Driver(boost::asio::io_service &io_service);
+  ~Gx3Driver();
+
+  // Open the port and configure the device for continuous output. With
+  // reconnect set, a device that does not answer is not an error; start()
+  // then keeps trying.
+  bool open(const Config &config);
+
+  // Open a raw log to replay instead, as fast as possible or paced by
+  // 'rate' times the recorded speed
+  bool open_replay(const std::string &path, double rate = 0.0);
+
+  // Append every chunk read from now on to a raw log
+  bool open_capture(const std::string &path);
+
+  // Restart the device timer at zero and take the current host time as t0
+  bool reset_timer();
+
+  // Start streaming. Returns immediately, the work happens in the
+  // io_service handlers.
+  void start();
+
+  // Cancel pending operations. Must be called from within strand().
+  void stop();
+
+  // Stop continuous mode on the device and close the port and capture
+  void close();
+
+  // Ask a polled device for one sample. Can be called from any thread.
+  // The request goes out through the strand without waiting for earlier
+  // replies, so polls in quick succession pipeline; the reply arrives
+  // through the frame and sample callbacks like streamed data.
+  void poll();
+
+  // Raw frames of preset().length bytes, checksum already verified
+  void set_frame_callback(const FrameCallback &callback) { frame_callback_ = callback; }
+  // Decoded frames, only decoded when this callback is set
+  void set_sample_callback(const SampleCallback &callback) { sample_callback_ = callback; }
+  // Handshake progress and stream errors, written to stderr when unset
+  void set_log_callback(const LogCallback &callback) { log_callback_ = callback; }
+  // Called when streaming ends on its own: a read error without reconnect
+  // or the end of a replay. Not called for stop().
+  void set_stop_callback(const StopCallback &callback) { stop_callback_ = callback; }
+
+  boost::asio::io_service::strand &strand() { return strand_; }
+
+  const Config &config() const { return config_; }
+  const Preset &preset() const { return *preset_; }
+  bool replaying() const { return replay_.is_open(); }
+  bool streaming() const { return !stopped_; }
+  bool reconnecting() const { return reconnecting_; }
+  unsigned long reconnects() const { return reconnects_; }
+
+  // Host time of the device timer reset; timer ticks run at TICK_RATE.
+  // Changes with every reconnect.
+  int64_t t0() const { return t0_; }
+  static const double TICK_RATE;
+
+  // Reset the timers of several open devices back to back, so their
+  // device stamps share one epoch. All of them get the same t0. Drivers
+  // replaying a log are left alone.
+  static bool reset_timers(const std::vector<Gx3Driver*> &drivers);
+
+  // Output rate resulting from the configured rate, or 0 if the device
+  // setting was left untouched or the device is polled
+  double output_rate() const;
+
+  // Port name or replayed log
+  const std::string &source() const { return source_; }
+
+  const FrameParser &parser() const { return parser_; }
+  unsigned long reads() const { return reads_; }
+  unsigned long bytes_read() const { return bytes_read_; }
+
+  // Polls sent, and polls dropped because the device was not ready, too
+  // many were outstanding or no reply came within handshake_timeout
+  unsigned long polls() const { return polls_; }
+  unsigned long poll_misses() const { return poll_misses_; }
+
+  // Bias the device captured and now subtracts (rad/s), if it did
+  bool gyro_bias_captured() const { return gyro_bias_captured_; }
+  const float *captured_gyro_bias() const { return captured_gyro_bias_; }
+
+  // Time spent handling each read since the last call
+  LatencyStats take_read_time();
+  // Time from sending a poll to receiving its reply since the last call
+  LatencyStats take_poll_latency();
+
+private:
+  Gx3Driver(const Gx3Driver &);
+  Gx3Driver &operator=(const Gx3Driver &);
+
+  bool connect(bool reset_timer);
+  bool configure();
+  bool can_quick_start() const;
+  bool detect_stream();
+  bool open_port(int baud);
+  void close_port();
+  size_t read_some(unsigned char *data, size_t length, double timeout);
+  bool read_reply(unsigned char *reply, size_t length, double timeout);
+  void drain();
+  void apply_stream_settings();
+  // Replies time out after 'timeout', by default handshake_timeout
+  bool send_command(const char *cmd, size_t cmd_length,
+                    unsigned char *reply, size_t reply_length,
+                    double timeout = 0.0);
+  bool changes_sampling() const;
+  bool set_sampling();
+  bool capture_gyro_bias();
+  bool set_baud();
+  void write_timer_reset();
+  void read_timer_reset();
+
+  void start_deadline();
+  void wait_deadline(const boost::posix_time::time_duration &wait);
+  void start_read();
+  void handle_read(const boost::system::error_code &error, size_t length);
+  void process_bytes(const unsigned char *bytes, size_t length, int64_t received);
+  void replay_next();
+  void handle_replay_timer(const boost::system::error_code &error);
+  void handle_deadline(const boost::system::error_code &error);
+  void send_poll();
+  void handle_poll_write(const boost::system::error_code &error);
+  void expire_polls(int64_t now);
+  void finish();
+  void begin_reconnect();
+  void handle_reconnect_timer(const boost::system::error_code &error);
+  void reconnect_attempt();
+  void handle_reconnect_result(bool connected);
+
+  void log(LogLevel level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+  boost::asio::io_service &io_service_;
+  boost::asio::io_service::strand strand_;
+  boost::asio::serial_port port_;
+  boost::asio::deadline_timer deadline_;
+  boost::posix_time::time_duration read_timeout_;
+
+  Config config_;
+  std::string source_;
+  const Preset *preset_;
+  FrameParser parser_;
+  std::vector<unsigned char> read_buffer_;
+  std::vector<unsigned char> data_;
+  int64_t t0_;
+
+  FrameCallback frame_callback_;
+  SampleCallback sample_callback_;
+  LogCallback log_callback_;
+  StopCallback stop_callback_;
+
+  RawLogWriter capture_;
+  RawLogReader replay_;
+  double replay_rate_;
+  boost::asio::deadline_timer replay_timer_;
+  double replay_start_;
+  int64_t replay_first_;
+
+  unsigned long reads_;
+  unsigned long bytes_read_;
+  // Monotonic time of the last read, checked by the deadline
+  double last_data_;
+  LatencyStats read_time_;
+  double last_sync_warning_;
+  bool stopped_;
+
+  // Send times of the polls still waiting for a reply
+  unsigned char poll_cmd_;
+  std::deque<int64_t> pending_polls_;
+  unsigned long polls_;
+  unsigned long poll_misses_;
+  LatencyStats poll_latency_;
+
+  bool gyro_bias_captured_;
+  float captured_gyro_bias_[3];
+
+  // Set once this process has stored the sampling settings and the link
+  // speed for persist; until then they are written with the store
+  // selector even when the device already runs with them
+  bool sampling_stored_;
+  bool baud_stored_;
+
+  // The handshake blocks, so a reconnect attempt runs in its own thread
+  // and reports back through the strand. The port is not touched from
+  // the strand while reconnecting_ is set.
+  boost::asio::deadline_timer reconnect_timer_;
+  boost::thread reconnect_thread_;
+  double reconnect_delay_;
+  bool reconnecting_;
+  unsigned long reconnects_;
+};
+
+}
+
+#endif
@@ -0,0 +1,342 @@
+// Interface to the Microstrain 3DM-GX3-25
+// N. Michael
+
+#ifndef IMU_3DM_GX3_IMU_3DM_GX3_H
+#define IMU_3DM_GX3_IMU_3DM_GX3_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <ros/ros.h>
+#include <geometry_msgs/Vector3Stamped.h>
+#include <sensor_msgs/Imu.h>
+#include <sensor_msgs/MagneticField.h>
+#include <std_msgs/Header.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <diagnostic_updater/update_functions.h>
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <imu_3dm_gx3/bias_estimator.h>
+#include <imu_3dm_gx3/edge_trigger.h>
+#include <imu_3dm_gx3/gx3_driver.h>
+#include <imu_3dm_gx3/message_pool.h>
+#include <imu_3dm_gx3/orientation_filter.h>
+#include <imu_3dm_gx3/preintegration.h>
+#include <imu_3dm_gx3/sequence_tracker.h>
+#include <imu_3dm_gx3/statistics.h>
+#include <imu_3dm_gx3/timestamp_filter.h>
+#include <imu_3dm_gx3/trace.h>
+#include <imu_3dm_gx3/ImuBatch.h>
+#include <imu_3dm_gx3/ImuPreintegration.h>
+#include <imu_3dm_gx3/OrientationMatrix.h>
+#include <imu_3dm_gx3/SampleInfo.h>
+
+namespace imu_3dm_gx3
+{
+
+// Apply the lock_memory, sched_priority and cpu_affinity parameters of
+// 'n' to the calling thread. Call it from every thread that runs the
+// io_service, before run().
+void configure_io_thread(const ros::NodeHandle &n, const std::string &name);
+
+// ROS interface for one IMU. The device itself is handled by Gx3Driver on
+// the given io_service; this class reads the parameters, publishes the
+// frames the driver hands over and reports on /diagnostics. The
+// diagnostics timer also notices a ROS shutdown. Several instances can
+// share one io_service.
+//
+// Frames are passed to a publish thread through a bounded lock-free
+// single producer/single consumer queue, so a slow publish() never delays
+// the next serial read. With queue_size 0 frames are decoded and published
+// directly in the read handler.
+//
+// Messages are published as shared pointers that are never touched after
+// publish(), so subscribers in the same nodelet manager receive them
+// without serialization or copy. A message is only built when its topic
+// has subscribers. Messages come from per topic pools allocated at
+// startup and are refilled once nobody references them any more, so
+// streaming does not allocate.
+//
+// With polled set, the device only sends a sample when asked to: on every
+// message on poll_trigger and on every edge of the poll_gpio line.
+//
+// Samples are numbered by the device timer. Lost samples (a step of more
+// than one period) and repeated ones are counted, repeated ones dropped,
+// and sample_info carries the sequence number and loss count of every
+// sample. With fill_gaps short gaps are filled with interpolated samples.
+//
+// Stamps come from the device timer (stamp_mode "device"), the host
+// receive time ("host"), or the device timer mapped to host time by a
+// continuously estimated offset and skew ("filtered").
+//
+// With batch_size or batch_period set, samples are additionally collected
+// into ImuBatch messages on the imu_batch topic. With
+// preintegration_period or preintegration_trigger set, angular rate and
+// acceleration are preintegrated over consecutive windows and published
+// as ImuPreintegration messages on imu_preintegrated, one per window
+// instead of every sample.
+//
+// With fusion set, a Madgwick or complementary filter fuses angular rate,
+// acceleration and magnetic field into a host side orientation published
+// on imu_fused, sample by sample and independent of the orientation the
+// device computes.
+//
+// With decimation set, imu_decimated and magnetic_decimated carry
+// averages over that many samples for low rate consumers, so they do not
+// have to subscribe to the full rate topics.
+//
+// With capture_file set, every chunk read from the port is appended to a
+// raw log together with its host receive time. With replay_file set, no
+// device is opened; the driver feeds the log through the same path
+// instead, as fast as possible or paced by replay_rate.
+//
+// Stream statistics (frames, checksum failures, resyncs, queue usage,
+// sample intervals and latencies) are published on /diagnostics.
+class Imu3dmGx3
+{
+public:
+  Imu3dmGx3(boost::asio::io_service &io_service, ros::NodeHandle &n,
+            const std::string &name);
+
+  // Open the port and configure the device for continuous output, or open
+  // the raw log to replay. With reset_timer false the device timer is left
+  // for reset_timers().
+  bool initialize(bool reset_timer = true);
+
+  // Reset the device timers of several IMUs together, so that their
+  // device stamps are comparable. See Gx3Driver::reset_timers().
+  static bool reset_timers(const std::vector<Imu3dmGx3*> &imus);
+
+  // Start streaming. Returns immediately, the work happens in the
+  // io_service handlers.
+  void start();
+
+  // Cancel pending operations so io_service.run() returns. Must be called
+  // from within the driver strand, request_stop() can be called from
+  // anywhere.
+  void stop();
+  void request_stop();
+
+  // Called once stop() has run, whatever stopped the stream
+  void set_stop_callback(const boost::function<void ()> &callback) { stop_callback_ = callback; }
+
+  // Stop continuous mode on the device and close the port
+  void close();
+
+private:
+  bool open_capture();
+  void handle_frame(const unsigned char *data, int64_t received);
+  void handle_log(Gx3Driver::LogLevel level, const std::string &message);
+  void start_diagnostics_timer();
+  void handle_diagnostics_timer(const boost::system::error_code &error);
+  void diagnose(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void push_frame(const unsigned char *data, const ros::Time &received,
+                  const ros::Time &t0);
+  void publish_loop();
+  void publish_frame(const unsigned char *data, const ros::Time &received,
+                     const ros::Time &t0);
+  void publish_sample(const Sample &sample, const ros::Time &stamp, uint64_t ticks,
+                      uint64_t sequence, unsigned long missed, bool interpolated);
+  static void interpolate_sample(const Sample &a, const Sample &b, double f, Sample &out);
+  ros::Time stamp_sample(uint64_t ticks, const ros::Time &received);
+  void restart_timer(const ros::Time &t0);
+  void batch_sample(const ros::Time &stamp,
+                    const sensor_msgs::ImuConstPtr &imu_msg,
+                    const sensor_msgs::MagneticFieldConstPtr &mag_msg);
+  void handle_trigger(const std_msgs::HeaderConstPtr &msg);
+  void handle_poll_trigger(const std_msgs::HeaderConstPtr &msg);
+  void preintegrate_sample(const ros::Time &stamp, const Sample &sample);
+  void fuse_sample(const ros::Time &stamp, const Sample &sample);
+  void decimate_sample(const ros::Time &stamp, const Sample &sample);
+  bool sample_orientation(const Sample &sample, double *q) const;
+  void estimate_gyro_bias(const ros::Time &stamp, const Sample &sample);
+  void init_imu(sensor_msgs::Imu &msg);
+  void init_mag(sensor_msgs::MagneticField &msg);
+  void init_fused(sensor_msgs::Imu &msg);
+  void init_decimated_imu(sensor_msgs::Imu &msg);
+  void init_decimated_mag(sensor_msgs::MagneticField &msg);
+  void init_batch(ImuBatch &msg);
+  template <class M> void init_header(M &msg) { msg.header.frame_id = frame_id_; }
+  void publish_preintegration(const ros::Time &end);
+
+  ros::NodeHandle n_;
+  std::string name_;
+
+  Gx3Driver::Config config_;
+  std::string frame_id_;
+  double delay_;
+  ros::Duration delay_duration_;
+
+  Gx3Driver driver_;
+  const Preset *preset_;
+
+  // Covariances copied into every message, -1 in the first element where
+  // the preset does not carry the field
+  double ang_vel_stdev_;
+  double accel_stdev_;
+  double orientation_stdev_;
+  double mag_stdev_;
+  boost::array<double, 9> ang_vel_cov_;
+  boost::array<double, 9> accel_cov_;
+  boost::array<double, 9> orientation_cov_;
+  boost::array<double, 9> mag_cov_;
+
+  // Only touched by the publishing thread, the copy for diagnostics is
+  // guarded by stats_mutex_
+  StaticBiasEstimator bias_estimator_;
+  bool estimate_bias_;
+  float gyro_bias_[3];
+
+  struct RawFrame
+  {
+    unsigned char data[MAX_FRAME_LENGTH];
+    ros::Time received;
+    // Timer reset the frame counts from, changes on reconnect
+    ros::Time t0;
+  };
+
+  // Read/publish handoff. The mutex and condition only put the publish
+  // thread to sleep while the queue is empty; the queue itself is lock-free.
+  int queue_size_;
+  boost::scoped_ptr<boost::lockfree::spsc_queue<RawFrame> > queue_;
+  boost::thread publish_thread_;
+  boost::atomic<bool> publish_running_;
+  boost::atomic<bool> publish_waiting_;
+  boost::mutex publish_mutex_;
+  boost::condition_variable publish_cond_;
+  size_t queue_high_water_;
+  unsigned long queue_drops_;
+
+  ros::Publisher imu_pub_;
+  ros::Publisher mag_pub_;
+  ros::Publisher matrix_pub_;
+  ros::Publisher stab_accel_pub_;
+  ros::Publisher stab_mag_pub_;
+  ros::Publisher info_pub_;
+
+  // Publishing thread only
+  bool track_sequence_;
+  SequenceTracker sequence_;
+  bool fill_gaps_;
+  int max_fill_gap_;
+  Sample last_sample_;
+  uint64_t last_ticks_;
+
+  int pool_size_;
+  MessagePool<sensor_msgs::Imu> imu_pool_;
+  MessagePool<sensor_msgs::MagneticField> mag_pool_;
+  MessagePool<OrientationMatrix> matrix_pool_;
+  MessagePool<geometry_msgs::Vector3Stamped> stab_accel_pool_;
+  MessagePool<sensor_msgs::MagneticField> stab_mag_pool_;
+  MessagePool<ImuBatch> batch_pool_;
+  MessagePool<ImuPreintegration> preint_pool_;
+  MessagePool<sensor_msgs::Imu> fused_pool_;
+  MessagePool<sensor_msgs::Imu> dec_imu_pool_;
+  MessagePool<sensor_msgs::MagneticField> dec_mag_pool_;
+  MessagePool<SampleInfo> info_pool_;
+
+  ros::Subscriber poll_sub_;
+  std::string poll_gpio_;
+  EdgeTrigger edge_trigger_;
+
+  int batch_size_;
+  double batch_period_;
+  int batch_samples_;
+  ros::Publisher batch_pub_;
+  ImuBatchPtr batch_;
+
+  // Windows end every preint_period_ seconds or at the stamps received
+  // on preintegration_trigger. Triggers come from a ROS callback thread.
+  double preint_period_;
+  bool preint_trigger_;
+  ros::Publisher preint_pub_;
+  ros::Subscriber trigger_sub_;
+  Preintegrator preint_;
+  ros::Time preint_start_;
+  ros::Time preint_last_;
+  boost::mutex trigger_mutex_;
+  std::deque<ros::Time> triggers_;
+
+  // Running sums of the current decimation window; stamps are summed as
+  // offsets from its first one
+  int decimation_;
+  ros::Publisher dec_imu_pub_;
+  ros::Publisher dec_mag_pub_;
+  int dec_samples_;
+  ros::Time dec_start_;
+  double dec_offset_;
+  double dec_ang_vel_[3];
+  double dec_accel_[3];
+  double dec_mag_[3];
+  double dec_q_[4];
+  bool dec_has_q_;
+
+  // The filter runs on every sample, subscribed or not, so the estimate
+  // is settled whenever somebody starts listening
+  bool fuse_;
+  ros::Publisher fused_pub_;
+  OrientationFilter fusion_;
+  bool fusion_mag_;
+  ros::Time fusion_last_;
+
+  enum StampMode
+  {
+    STAMP_DEVICE,
+    STAMP_HOST,
+    STAMP_FILTERED
+  };
+
+  StampMode stamp_mode_;
+  // Host time of the device timer reset as the driver reported it, and
+  // as moved by a timer that restarted on its own
+  ros::Time driver_t0_;
+  ros::Time t0_;
+  // t0_ - delay, the origin of device stamps
+  ros::Time stamp_base_;
+  TickUnwrapper ticks_;
+  TimestampFilter clock_;
+
+  // Diagnostics run on the io_service thread, so the driver counters need
+  // no locking. The publish side ones are guarded by stats_mutex_.
+  diagnostic_updater::Updater updater_;
+  boost::scoped_ptr<diagnostic_updater::FrequencyStatus> freq_status_;
+  double min_freq_;
+  double max_freq_;
+  boost::asio::deadline_timer diag_timer_;
+  boost::posix_time::time_duration diag_period_;
+
+  std::string capture_file_;
+  std::string trace_file_;
+  std::string replay_file_;
+  double replay_rate_;
+
+  unsigned long last_frames_;
+  unsigned long last_checksum_failures_;
+  unsigned long last_resyncs_;
+  unsigned long last_queue_drops_;
+  unsigned long last_polls_;
+  unsigned long last_dropped_;
+
+  boost::mutex stats_mutex_;
+  unsigned long published_;
+  unsigned long pool_allocations_;
+  unsigned long diag_dropped_;
+  unsigned long diag_gaps_;
+  unsigned long diag_duplicates_;
+  LatencyStats publish_latency_;
+  IntervalHistogram intervals_;
+  ros::Time last_received_;
+  double diag_gyro_bias_[3];
+  unsigned long diag_bias_restarts_;
+  bool stopped_;
+  boost::function<void ()> stop_callback_;
+};
+
+}
+
+#endif
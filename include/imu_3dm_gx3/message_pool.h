@@ -0,0 +1,86 @@
+// Recycled messages for the Microstrain 3DM-GX3-25 publishers
+// N. Michael
+
+#ifndef IMU_3DM_GX3_MESSAGE_POOL_H
+#define IMU_3DM_GX3_MESSAGE_POOL_H
+
+#include <cstddef>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace imu_3dm_gx3
+{
+
+// Fixed set of preallocated messages handed out as shared pointers. A
+// message is handed out again once every other reference to it is gone,
+// i.e. once all subscribers and the publisher queue let go, so publishing
+// a recycled message is as safe as publishing a fresh one. Fields that
+// never change (frame id, covariances) are set once by 'init' when the
+// message is created; everything else keeps the value it was last
+// published with and has to be overwritten.
+//
+// If every message is still referenced, acquire() hands out a fresh one
+// that is not kept; allocations() counts those, so in steady state it
+// stays constant. A pool of size 0 allocates every time.
+//
+// acquire() must only be called from one thread at a time.
+template <class M>
+class MessagePool
+{
+public:
+  typedef boost::shared_ptr<M> Ptr;
+  typedef boost::function<void (M &)> Init;
+
+  MessagePool() : next_(0), allocations_(0) {}
+
+  // Preallocate 'size' messages set up by 'init'
+  void reset(size_t size, const Init &init = Init())
+  {
+    init_ = init;
+    messages_.clear();
+    messages_.reserve(size);
+    for (size_t i = 0; i < size; i++)
+      messages_.push_back(create());
+    next_ = 0;
+    allocations_ = 0;
+  }
+
+  Ptr acquire()
+  {
+    // Messages are released roughly in the order they were published, so
+    // the search from the oldest one usually ends right away
+    for (size_t i = 0; i < messages_.size(); i++)
+      {
+        Ptr &message = messages_[next_];
+        next_ = next_ + 1 < messages_.size() ? next_ + 1 : 0;
+        if (message.use_count() == 1)
+          return message;
+      }
+
+    allocations_++;
+    return create();
+  }
+
+  size_t size() const { return messages_.size(); }
+  unsigned long allocations() const { return allocations_; }
+
+private:
+  Ptr create()
+  {
+    Ptr message = boost::make_shared<M>();
+    if (init_)
+      init_(*message);
+    return message;
+  }
+
+  std::vector<Ptr> messages_;
+  size_t next_;
+  Init init_;
+  unsigned long allocations_;
+};
+
+}
+
+#endif
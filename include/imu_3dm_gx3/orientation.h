@@ -0,0 +1,44 @@
+// Orientation conversions for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#ifndef IMU_3DM_GX3_ORIENTATION_H
+#define IMU_3DM_GX3_ORIENTATION_H
+
+#include <cmath>
+#include <eigen3/Eigen/Geometry>
+
+namespace imu_3dm_gx3
+{
+
+// Quaternion (w, x, y, z) of the transpose of the device orientation
+// matrix M, which is sent row by row
+inline void matrix_to_quaternion(const float *M, double *q)
+{
+  Eigen::Matrix3d R;
+  for (unsigned int i = 0; i < 3; i++)
+    for (unsigned int j = 0; j < 3; j++)
+      R(i,j) = M[j*3+i];
+  Eigen::Quaternion<double> quat(R);
+  q[0] = quat.w();
+  q[1] = quat.x();
+  q[2] = quat.y();
+  q[3] = quat.z();
+}
+
+// Quaternion (w, x, y, z) of the same rotation from the device Euler
+// angles (roll, pitch, yaw), which parametrize M as R_x(roll) R_y(pitch)
+// R_z(yaw) transposed
+inline void euler_to_quaternion(const float *euler, double *q)
+{
+  double cr = cos(0.5 * euler[0]), sr = sin(0.5 * euler[0]);
+  double cp = cos(0.5 * euler[1]), sp = sin(0.5 * euler[1]);
+  double cy = cos(0.5 * euler[2]), sy = sin(0.5 * euler[2]);
+  q[0] = cr * cp * cy + sr * sp * sy;
+  q[1] = sr * cp * cy - cr * sp * sy;
+  q[2] = cr * sp * cy + sr * cp * sy;
+  q[3] = cr * cp * sy - sr * sp * cy;
+}
+
+}
+
+#endif
@@ -0,0 +1,57 @@
+// Host side orientation fusion for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#ifndef IMU_3DM_GX3_ORIENTATION_FILTER_H
+#define IMU_3DM_GX3_ORIENTATION_FILTER_H
+
+namespace imu_3dm_gx3
+{
+
+// Attitude from angular rate, corrected towards the direction of gravity
+// and, if given, of the magnetic field. The estimate is the rotation from
+// the sensor frame to a frame with z up and x towards magnetic north, or
+// towards the initial heading without magnetometer.
+//
+// Both methods integrate the angular rate plus a correction rate along
+// the cross product of the measured and the predicted directions:
+// MADGWICK uses the unit correction scaled by 2 'gain' (Madgwick's beta,
+// rad/s), i.e. his gradient descent step; COMPLEMENTARY uses the cross
+// product scaled by 'gain' (1/s, the inverse time constant), i.e.
+// Mahony's proportional filter.
+//
+// The first update, and the first one after reset(), takes the
+// orientation straight from the accelerometer and magnetometer.
+class OrientationFilter
+{
+public:
+  enum Method
+  {
+    MADGWICK,
+    COMPLEMENTARY
+  };
+
+  OrientationFilter(Method method = MADGWICK, double gain = 0.1);
+
+  void reset() { initialized_ = false; }
+  bool initialized() const { return initialized_; }
+
+  // Angular rate in rad/s held for 'dt' seconds. Only the directions of
+  // the specific force and the magnetic field count, so any unit works;
+  // 'mag' may be NULL.
+  void update(const double *ang_vel, const double *accel, const double *mag, double dt);
+
+  // Rotation from the sensor frame (w, x, y, z)
+  const double *quaternion() const { return q_; }
+
+private:
+  void initialize(const double *accel, const double *mag);
+
+  Method method_;
+  double gain_;
+  bool initialized_;
+  double q_[4];
+};
+
+}
+
+#endif
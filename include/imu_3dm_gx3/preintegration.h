@@ -0,0 +1,82 @@
+// IMU preintegration for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#ifndef IMU_3DM_GX3_PREINTEGRATION_H
+#define IMU_3DM_GX3_PREINTEGRATION_H
+
+namespace imu_3dm_gx3
+{
+
+// Integrates angular rate and specific force over a window into relative
+// rotation, velocity and position increments in the frame of the first
+// sample, as done by preintegration based estimators (Forster et al.,
+// "On-Manifold Preintegration for Real-Time Visual-Inertial Odometry").
+// Gravity is not removed; that is up to the consumer, which knows the
+// orientation of the window start.
+//
+// Alongside the increments it propagates their 9x9 covariance (order
+// rotation, velocity, position) from white noise densities, and the
+// Jacobians with respect to the gyro and accelerometer biases, so that a
+// consumer can correct the increments for a new bias estimate to first
+// order without reintegrating. All matrices are row major.
+class Preintegrator
+{
+public:
+  // Noise densities in rad/s/sqrt(Hz) and m/s^2/sqrt(Hz)
+  Preintegrator(double gyro_noise = 0.0, double accel_noise = 0.0);
+
+  // Bias the measurements are corrected by, i.e. the linearization point
+  // of the Jacobians. Applies from the next reset().
+  void set_bias(const double *gyro_bias, const double *accel_bias);
+
+  // Start a new window
+  void reset();
+
+  // Add a measurement held for 'dt' seconds, in rad/s and m/s^2
+  void integrate(const double *ang_vel, const double *accel, double dt);
+
+  int samples() const { return samples_; }
+  double duration() const { return duration_; }
+
+  const double *gyro_bias() const { return window_gyro_bias_; }
+  const double *accel_bias() const { return window_accel_bias_; }
+
+  // Rotation from the frame at the end of the window to the frame at its
+  // start, as a matrix and as a quaternion (w, x, y, z)
+  const double *delta_rotation() const { return dR_; }
+  void delta_quaternion(double *q) const;
+  const double *delta_velocity() const { return dv_; }
+  const double *delta_position() const { return dp_; }
+
+  const double *d_rotation_d_gyro_bias() const { return dR_dbg_; }
+  const double *d_velocity_d_gyro_bias() const { return dv_dbg_; }
+  const double *d_velocity_d_accel_bias() const { return dv_dba_; }
+  const double *d_position_d_gyro_bias() const { return dp_dbg_; }
+  const double *d_position_d_accel_bias() const { return dp_dba_; }
+
+  const double *covariance() const { return cov_; }
+
+private:
+  double gyro_var_;
+  double accel_var_;
+  double gyro_bias_[3];
+  double accel_bias_[3];
+  double window_gyro_bias_[3];
+  double window_accel_bias_[3];
+
+  int samples_;
+  double duration_;
+  double dR_[9];
+  double dv_[3];
+  double dp_[3];
+  double dR_dbg_[9];
+  double dv_dbg_[9];
+  double dv_dba_[9];
+  double dp_dbg_[9];
+  double dp_dba_[9];
+  double cov_[81];
+};
+
+}
+
+#endif
@@ -0,0 +1,44 @@
+// Data presets of the Microstrain 3DM-GX3-25 single byte protocol
+// N. Michael
+
+#ifndef IMU_3DM_GX3_PRESETS_H
+#define IMU_3DM_GX3_PRESETS_H
+
+#include <cstddef>
+#include <string>
+
+namespace imu_3dm_gx3
+{
+
+// Layout of a data reply. Every field is given as the index of its first
+// 32 bit word after the header byte, or -1 when the preset does not carry
+// it. The reply starts with the command byte and ends with the timer and
+// a 16 bit checksum.
+// More detail in '3DM-GX3-25 Single Byte Data Communications Protocol'
+struct Preset
+{
+  unsigned char command;
+  const char *name;
+  size_t length;
+  int accel;
+  int ang_vel;
+  int mag;
+  int orientation_matrix;
+  int quaternion;
+  int euler;
+  int stab_accel;
+  int stab_mag;
+  int timer;
+};
+
+// Largest payload of any preset, in 32 bit words
+#define MAX_PAYLOAD_WORDS 19
+#define MAX_FRAME_LENGTH (MAX_PAYLOAD_WORDS * 4 + 3)
+
+// Look a preset up by command byte or by name; 0 if unknown
+const Preset *find_preset(unsigned char command);
+const Preset *find_preset(const std::string &name);
+
+}
+
+#endif
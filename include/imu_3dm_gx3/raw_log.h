@@ -0,0 +1,83 @@
+// Raw serial capture for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#ifndef IMU_3DM_GX3_RAW_LOG_H
+#define IMU_3DM_GX3_RAW_LOG_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <stdint.h>
+
+namespace imu_3dm_gx3
+{
+
+// A raw log is a 24 byte file header followed by one record per serial
+// read, so it can be memory mapped and walked without parsing:
+//
+//   header: char magic[8] = "GX3RAW01", uint32 byte order mark 0x01020304,
+//           uint32 preset command, int64 host time of the timer reset (ns)
+//   record: int64 host receive time (ns), uint32 length, length bytes
+//
+// Integers are stored in host byte order; the mark lets a reader reject
+// logs written on a machine of the other endianness.
+struct RawLogHeader
+{
+  unsigned char preset;
+  int64_t t0;
+};
+
+class RawLogWriter
+{
+public:
+  RawLogWriter();
+  ~RawLogWriter();
+
+  bool open(const std::string &path, const RawLogHeader &header);
+  void close();
+  bool is_open() const { return file_ != 0; }
+
+  bool write(int64_t received, const unsigned char *data, uint32_t length);
+
+private:
+  RawLogWriter(const RawLogWriter &);
+  RawLogWriter &operator=(const RawLogWriter &);
+
+  FILE *file_;
+};
+
+class RawLogReader
+{
+public:
+  RawLogReader();
+  ~RawLogReader();
+
+  bool open(const std::string &path);
+  void close();
+  bool is_open() const { return map_ != 0; }
+
+  const RawLogHeader &header() const { return header_; }
+
+  // Point at the next record; the data stays valid until close().
+  // Returns false at the end of the log or on a truncated record.
+  bool next(int64_t &received, const unsigned char *&data, uint32_t &length);
+
+  // Receive time of the record next() would return, without consuming it
+  bool peek(int64_t &received) const;
+
+  // Start over from the first record
+  void rewind();
+
+private:
+  RawLogReader(const RawLogReader &);
+  RawLogReader &operator=(const RawLogReader &);
+
+  const unsigned char *map_;
+  size_t size_;
+  size_t offset_;
+  RawLogHeader header_;
+};
+
+}
+
+#endif
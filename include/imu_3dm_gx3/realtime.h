@@ -0,0 +1,28 @@
+// Real-time scheduling helpers for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#ifndef IMU_3DM_GX3_REALTIME_H
+#define IMU_3DM_GX3_REALTIME_H
+
+#include <vector>
+
+namespace imu_3dm_gx3
+{
+
+// All of these return false and leave errno set on failure. Raising the
+// priority and locking memory need CAP_SYS_NICE and CAP_IPC_LOCK, or the
+// matching rtprio and memlock limits.
+
+// Run the calling thread under SCHED_FIFO at 'priority' (1 to 99)
+bool set_thread_priority(int priority);
+
+// Restrict the calling thread to the given CPUs
+bool set_thread_affinity(const std::vector<int> &cpus);
+
+// Lock current and future pages of the process in memory, so page faults
+// do not end up in the read path
+bool lock_memory();
+
+}
+
+#endif
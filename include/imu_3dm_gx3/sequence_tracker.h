@@ -0,0 +1,76 @@
+// Dropped sample detection for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#ifndef IMU_3DM_GX3_SEQUENCE_TRACKER_H
+#define IMU_3DM_GX3_SEQUENCE_TRACKER_H
+
+#include <stdint.h>
+
+namespace imu_3dm_gx3
+{
+
+// Numbers samples by their device timer. The device samples at a fixed
+// decimation of its clock, so consecutive samples are 'expected' ticks
+// apart; a larger step means samples were lost between device and
+// consumer, a step of less than half a period a repeated sample. A step
+// back of more than a few periods is a timer that started over without
+// restart(), e.g. after a brownout while streaming, and is taken like a
+// restart. The sequence number counts device sample periods, so it skips
+// over lost samples.
+//
+// With 'expected' 0 the period is learned as the smallest of the first
+// few steps; until then every sample counts as the next one.
+class SequenceTracker
+{
+public:
+  enum Result
+  {
+    FIRST,
+    NEXT,
+    GAP,
+    DUPLICATE,
+    RESTART
+  };
+
+  SequenceTracker(double expected = 0.0);
+
+  // Start over after a timer reset. The sequence continues from where it
+  // was, and nothing is counted as lost across the reset.
+  void restart();
+
+  // Classify a sample by its unwrapped device ticks
+  Result update(uint64_t ticks);
+
+  double expected() const { return expected_; }
+
+  // Of the last sample that was not a duplicate
+  uint64_t sequence() const { return sequence_; }
+  uint64_t ticks() const { return last_; }
+  // Samples lost right before the last one
+  unsigned long missed() const { return missed_; }
+
+  unsigned long dropped() const { return dropped_; }
+  unsigned long duplicates() const { return duplicates_; }
+  unsigned long gaps() const { return gaps_; }
+
+private:
+  enum { LEARN_STEPS = 8, RESTART_PERIODS = 4 };
+
+  double expected_;
+  int learned_steps_;
+  uint64_t shortest_;
+
+  bool started_;
+  bool numbered_;
+  uint64_t last_;
+  uint64_t sequence_;
+  unsigned long missed_;
+
+  unsigned long dropped_;
+  unsigned long duplicates_;
+  unsigned long gaps_;
+};
+
+}
+
+#endif
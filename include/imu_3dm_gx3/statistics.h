@@ -0,0 +1,72 @@
+// Streaming statistics for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#ifndef IMU_3DM_GX3_STATISTICS_H
+#define IMU_3DM_GX3_STATISTICS_H
+
+#include <cstddef>
+
+namespace imu_3dm_gx3
+{
+
+// Count, mean and maximum of a duration in seconds
+struct LatencyStats
+{
+  LatencyStats() { reset(); }
+
+  void reset()
+  {
+    count = 0;
+    sum = 0.0;
+    max = 0.0;
+  }
+
+  void add(double v)
+  {
+    count++;
+    sum += v;
+    if (v > max)
+      max = v;
+  }
+
+  double mean() const { return count > 0 ? sum / count : 0.0; }
+
+  unsigned long count;
+  double sum;
+  double max;
+};
+
+// Histogram of intervals in seconds over fixed, roughly logarithmic bins
+// from 0.5 ms to 50 ms; the last bin collects everything longer
+struct IntervalHistogram
+{
+  enum { BINS = 8 };
+
+  IntervalHistogram() { reset(); }
+
+  static double upper_bound(size_t bin)
+  {
+    static const double bounds[BINS - 1] = {0.0005, 0.001, 0.002, 0.005, 0.01, 0.02, 0.05};
+    return bounds[bin];
+  }
+
+  void reset()
+  {
+    for (size_t i = 0; i < BINS; i++)
+      counts[i] = 0;
+  }
+
+  void add(double v)
+  {
+    size_t bin = 0;
+    while (bin < BINS - 1 && v >= upper_bound(bin))
+      bin++;
+    counts[bin]++;
+  }
+
+  unsigned long counts[BINS];
+};
+
+}
+
+#endif
@@ -0,0 +1,106 @@
+// Device to host clock estimation for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#ifndef IMU_3DM_GX3_TIMESTAMP_FILTER_H
+#define IMU_3DM_GX3_TIMESTAMP_FILTER_H
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include <stdint.h>
+
+namespace imu_3dm_gx3
+{
+
+// Extends the 32 bit device timer to 64 bits across wraparound. A step
+// back of more than 'max_step_back' ticks is no repeated or reordered
+// sample but a timer that started over, e.g. a device that browned out
+// while streaming: the count then starts over from the new value and
+// restarted() is set until the next call.
+class TickUnwrapper
+{
+public:
+  TickUnwrapper() : initialized_(false), restarted_(false), last_(0), high_(0) {}
+
+  void reset() { initialized_ = false; restarted_ = false; high_ = 0; }
+
+  uint64_t unwrap(uint32_t ticks, uint32_t max_step_back = 0x80000000u)
+  {
+    restarted_ = false;
+    if (initialized_ && ticks < last_)
+      {
+        // A tick value below the previous one is a wrap unless it is only
+        // a step back
+        if (last_ - ticks > 0x80000000u)
+          high_ += 0x100000000ull;
+        else if (last_ - ticks > max_step_back)
+          {
+            restarted_ = true;
+            high_ = 0;
+          }
+      }
+    initialized_ = true;
+    last_ = ticks;
+    return high_ + ticks;
+  }
+
+  bool restarted() const { return restarted_; }
+
+private:
+  bool initialized_;
+  bool restarted_;
+  uint32_t last_;
+  uint64_t high_;
+};
+
+// Estimates offset and skew between the device clock and the host clock
+// from device sample times and host receive times. Transport delays are
+// strictly positive, so the receive times are bounded from below by the
+// true clock relation. The filter keeps the minimum offset (host - device)
+// of every 'bucket' seconds over the last 'window' seconds, builds the
+// lower convex hull of these points and uses the hull edge spanning their
+// mean: that is the line below all observations closest to them on
+// average. Both times are in seconds from a common reference.
+class TimestampFilter
+{
+public:
+  TimestampFilter(double window = 60.0, double bucket = 0.5);
+
+  void reset();
+
+  // Add an observation and return the host time of 'device'
+  double update(double device, double host);
+
+  // Host time of 'device' under the current model
+  double host_time(double device) const;
+
+  double offset() const { return offset_; }
+  double skew() const { return skew_; }
+
+private:
+  struct Point
+  {
+    double x;
+    double y;
+  };
+
+  void fit();
+
+  double window_;
+  double bucket_;
+
+  std::deque<Point> points_;
+  std::vector<Point> hull_;
+  bool bucket_open_;
+  Point current_;
+  double bucket_start_;
+
+  // offset(x) = offset_ + skew_ * (x - origin_)
+  double origin_;
+  double offset_;
+  double skew_;
+};
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+// Latency tracing for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#ifndef IMU_3DM_GX3_TRACE_H
+#define IMU_3DM_GX3_TRACE_H
+
+#include <string>
+#include <stdint.h>
+
+#ifdef IMU_3DM_GX3_HAVE_SDT
+#include <sys/sdt.h>
+#endif
+
+namespace imu_3dm_gx3
+{
+
+// Stages of a sample on its way from the port to the publishers. Events
+// of one sample share its key, the host receive time of the read it came
+// in (ns); a read of several frames records one READ and then one of
+// each other point per frame, in order.
+enum TracePoint
+{
+  TRACE_READ,     // read handler entered
+  TRACE_FRAME,    // frame boundary and checksum accepted
+  TRACE_DECODE,   // payload decoded on the publish side
+  TRACE_PUBLISH   // every topic of the sample published
+};
+
+// Append an event stamped with the monotonic clock to the process wide
+// trace ring, overwriting the oldest ones once it is full. Safe to call
+// from several threads without locking.
+void trace_event(TracePoint point, int64_t key);
+
+// Write the ring to 'path' as lines of "point key time_ns", oldest
+// first. Call it when no thread records any more.
+bool write_trace(const std::string &path);
+
+// Whether the tracepoints were compiled in
+bool trace_enabled();
+
+}
+
+// Tracepoints cost nothing unless the package is built with
+// IMU_3DM_GX3_TRACE. With <sys/sdt.h> they are USDT probes as well
+// (provider imu_3dm_gx3, probes READ, FRAME, DECODE, PUBLISH with the key
+// as argument), which perf, bpftrace or LTTng can attach to.
+#ifdef IMU_3DM_GX3_HAVE_SDT
+#define IMU_3DM_GX3_PROBE(point, key) DTRACE_PROBE1(imu_3dm_gx3, point, key)
+#else
+#define IMU_3DM_GX3_PROBE(point, key) do {} while (0)
+#endif
+
+#ifdef IMU_3DM_GX3_TRACE
+#define IMU_3DM_GX3_TRACE_POINT(point, key)                             \
+  do {                                                                  \
+    imu_3dm_gx3::trace_event(imu_3dm_gx3::TRACE_##point, (key));        \
+    IMU_3DM_GX3_PROBE(point, (key));                                    \
+  } while (0)
+#else
+#define IMU_3DM_GX3_TRACE_POINT(point, key) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+// Static gyro bias estimation for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#include <cmath>
+#include <imu_3dm_gx3/bias_estimator.h>
+
+namespace imu_3dm_gx3
+{
+
+StaticBiasEstimator::StaticBiasEstimator(double duration, double threshold, double chunk) :
+  duration_(duration),
+  threshold_(threshold),
+  chunk_(chunk)
+{
+  reset();
+}
+
+void StaticBiasEstimator::reset()
+{
+  started_ = false;
+  start_ = 0.0;
+  chunk_start_ = 0.0;
+  count_ = 0;
+  chunk_count_ = 0;
+  for (unsigned int i = 0; i < 3; i++)
+    {
+      sum_[i] = 0.0;
+      chunk_sum_[i] = 0.0;
+      bias_[i] = 0.0;
+    }
+  done_ = false;
+  restarts_ = 0;
+}
+
+bool StaticBiasEstimator::update(double t, const double *ang_vel)
+{
+  if (done_)
+    return false;
+
+  if (!started_)
+    {
+      started_ = true;
+      start_ = t;
+      chunk_start_ = t;
+    }
+
+  for (unsigned int i = 0; i < 3; i++)
+    chunk_sum_[i] += ang_vel[i];
+  chunk_count_++;
+
+  if (t - chunk_start_ < chunk_)
+    return false;
+
+  // A chunk is complete: check it against the window so far
+  bool moving = false;
+  if (count_ > 0)
+    for (unsigned int i = 0; i < 3; i++)
+      if (fabs(chunk_sum_[i] / chunk_count_ - sum_[i] / count_) > threshold_)
+        moving = true;
+
+  if (moving)
+    {
+      // Start over with this chunk as the first one
+      restarts_++;
+      start_ = chunk_start_;
+      count_ = 0;
+      for (unsigned int i = 0; i < 3; i++)
+        sum_[i] = 0.0;
+    }
+
+  for (unsigned int i = 0; i < 3; i++)
+    {
+      sum_[i] += chunk_sum_[i];
+      chunk_sum_[i] = 0.0;
+    }
+  count_ += chunk_count_;
+  chunk_count_ = 0;
+  chunk_start_ = t;
+
+  if (t - start_ < duration_)
+    return false;
+
+  for (unsigned int i = 0; i < 3; i++)
+    bias_[i] = sum_[i] / count_;
+  done_ = true;
+  return true;
+}
+
+}
@@ -0,0 +1,131 @@
+// External trigger edges for polling the Microstrain 3DM-GX3-25
+// N. Michael
+
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/pps.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <imu_3dm_gx3/edge_trigger.h>
+
+// How often the wait checks whether to stop (ms)
+#define STOP_CHECK_PERIOD 100
+
+namespace imu_3dm_gx3
+{
+
+static int64_t now_ns()
+{
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool is_pps(const std::string &path)
+{
+  return path.compare(0, 8, "/dev/pps") == 0;
+}
+
+EdgeTrigger::EdgeTrigger() :
+  fd_(-1),
+  running_(false),
+  edges_(0)
+{
+}
+
+EdgeTrigger::~EdgeTrigger()
+{
+  stop();
+}
+
+bool EdgeTrigger::start(const std::string &path, const Callback &callback)
+{
+  stop();
+
+  fd_ = ::open(path.c_str(), O_RDONLY);
+  if (fd_ < 0)
+    return false;
+
+  callback_ = callback;
+  running_ = true;
+  if (is_pps(path))
+    thread_ = boost::thread(boost::bind(&EdgeTrigger::run_pps, this));
+  else
+    thread_ = boost::thread(boost::bind(&EdgeTrigger::run_gpio, this));
+  return true;
+}
+
+void EdgeTrigger::stop()
+{
+  running_ = false;
+  if (thread_.joinable())
+    thread_.join();
+  if (fd_ >= 0)
+    {
+      ::close(fd_);
+      fd_ = -1;
+    }
+}
+
+// sysfs reports an edge as POLLPRI; the value has to be read back each
+// time to rearm it
+void EdgeTrigger::run_gpio()
+{
+  char value[8];
+  lseek(fd_, 0, SEEK_SET);
+  if (::read(fd_, value, sizeof(value)) < 0)
+    return;
+
+  while (running_)
+    {
+      pollfd pfd;
+      pfd.fd = fd_;
+      pfd.events = POLLPRI | POLLERR;
+      pfd.revents = 0;
+      int ready = ::poll(&pfd, 1, STOP_CHECK_PERIOD);
+      if (ready < 0 && errno != EINTR)
+        return;
+      if (ready <= 0)
+        continue;
+
+      int64_t edge = now_ns();
+      lseek(fd_, 0, SEEK_SET);
+      if (::read(fd_, value, sizeof(value)) < 0)
+        return;
+      edges_++;
+      callback_(edge);
+    }
+}
+
+void EdgeTrigger::run_pps()
+{
+  unsigned int last_sequence = 0;
+  bool first = true;
+  while (running_)
+    {
+      pps_fdata data;
+      data.timeout.sec = 0;
+      data.timeout.nsec = STOP_CHECK_PERIOD * 1000000;
+      data.timeout.flags = 0;
+      if (ioctl(fd_, PPS_FETCH, &data) < 0)
+        {
+          if (errno == ETIMEDOUT || errno == EINTR)
+            continue;
+          return;
+        }
+
+      // Only assert edges count, a clear edge wakes the fetch as well
+      if (!first && data.info.assert_sequence == last_sequence)
+        continue;
+      first = false;
+      last_sequence = data.info.assert_sequence;
+
+      edges_++;
+      callback_((int64_t)data.info.assert_tu.sec * 1000000000LL + data.info.assert_tu.nsec);
+    }
+}
+
+}
@@ -0,0 +1,144 @@
+// Streaming frame parser for the Microstrain 3DM-GX3-25 single byte protocol
+// N. Michael
+
+#include <algorithm>
+#include <cstring>
+#include <imu_3dm_gx3/frame_parser.h>
+
+namespace imu_3dm_gx3
+{
+
+bool validate_checksum(const unsigned char *data, unsigned short length)
+{
+  unsigned short chksum = 0;
+  unsigned short rchksum = 0;
+
+  for (unsigned short i = 0; i < length - 2; i++)
+    chksum += data[i];
+
+  rchksum = data[length - 2] << 8;
+  rchksum += data[length - 1];
+
+  return (chksum == rchksum);
+}
+
+FrameParser::FrameParser(unsigned char header, size_t frame_length,
+                         size_t capacity) :
+  header_(header),
+  frame_length_(frame_length),
+  ring_(capacity < 2 * frame_length ? 2 * frame_length : capacity),
+  head_(0),
+  size_(0),
+  lost_sync_(false),
+  frames_(0),
+  checksum_failures_(0),
+  resyncs_(0),
+  bytes_discarded_(0)
+{
+}
+
+void FrameParser::reset()
+{
+  head_ = 0;
+  size_ = 0;
+  lost_sync_ = false;
+}
+
+void FrameParser::advance(size_t n)
+{
+  head_ += n;
+  if (head_ >= ring_.size())
+    head_ -= ring_.size();
+  size_ -= n;
+}
+
+void FrameParser::discard(size_t n)
+{
+  advance(n);
+  bytes_discarded_ += n;
+}
+
+// The candidate frame as one contiguous block: in place unless it wraps
+// around the end of the ring, then assembled in 'scratch'
+const unsigned char *FrameParser::candidate(unsigned char *scratch) const
+{
+  if (head_ + frame_length_ <= ring_.size())
+    return &ring_[head_];
+
+  size_t first = ring_.size() - head_;
+  memcpy(scratch, &ring_[head_], first);
+  memcpy(scratch + first, &ring_[0], frame_length_ - first);
+  return scratch;
+}
+
+void FrameParser::feed(const unsigned char *data, size_t length)
+{
+  // Only the newest ring_.size() bytes can ever be kept
+  if (length > ring_.size())
+    {
+      bytes_discarded_ += length - ring_.size();
+      data += length - ring_.size();
+      length = ring_.size();
+    }
+
+  if (size_ + length > ring_.size())
+    {
+      discard(size_ + length - ring_.size());
+      lost_sync_ = true;
+    }
+
+  // At most two copies, up to the end of the ring and from its start
+  size_t tail = head_ + size_;
+  if (tail >= ring_.size())
+    tail -= ring_.size();
+  size_t first = std::min(length, ring_.size() - tail);
+  memcpy(&ring_[tail], data, first);
+  memcpy(&ring_[0], data + first, length - first);
+  size_ += length;
+}
+
+bool FrameParser::next(unsigned char *frame)
+{
+  while (size_ > 0)
+    {
+      if (ring_[head_] != header_)
+        {
+          if (!lost_sync_)
+            {
+              lost_sync_ = true;
+              resyncs_++;
+            }
+          discard(1);
+          continue;
+        }
+
+      if (size_ < frame_length_)
+        return false;
+
+      // The output buffer doubles as scratch space, it only has to hold
+      // the frame once the checksum matches
+      const unsigned char *data = candidate(frame);
+      if (!validate_checksum(data, frame_length_))
+        {
+          checksum_failures_++;
+          if (!lost_sync_)
+            {
+              lost_sync_ = true;
+              resyncs_++;
+            }
+          discard(1);
+          continue;
+        }
+
+      if (data != frame)
+        memcpy(frame, data, frame_length_);
+      advance(frame_length_);
+      lost_sync_ = false;
+      frames_++;
+      return true;
+    }
+
+  return false;
+}
+
+}
@@ -0,0 +1,1187 @@
+// ROS independent driver for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#include <cerrno>
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <linux/serial.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <imu_3dm_gx3/gx3_driver.h>
+#include <imu_3dm_gx3/trace.h>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#define REPLY_LENGTH 4
+#define STOP_CMD_LENGTH 3
+#define MODE_CMD_LENGTH 4
+#define DEFAULT_PRESET 0xCC
+#define COMM_CMD_LENGTH 11
+#define COMM_REPLY_LENGTH 10
+#define SAMPLING_CMD_LENGTH 20
+#define SAMPLING_REPLY_LENGTH 19
+#define TIMER_CMD_LENGTH 8
+#define TIMER_REPLY_LENGTH 7
+#define BIAS_CMD_LENGTH 5
+#define BIAS_REPLY_LENGTH 19
+#define MAX_FILTER_WINDOW 32
+#define CONING_SCULLING_FLAG 0x0002
+#define BASE_RATE 1000
+#define MAX_PENDING_POLLS 4
+
+namespace imu_3dm_gx3
+{
+
+static const char stop_cmd[3] = {'\xFA','\x75','\xB4'};  // stop continuous mode
+
+// Set Timer
+// Restart the time stamp at the new value
+// New Timer value equal to 0
+static const char set_timer_cmd[8] = {'\xD7','\xC1','\x29','\x01','\x00','\x00','\x00','\x00'};
+
+const double Gx3Driver::TICK_RATE = 62500.0;
+
+// Baud rates supported by the primary UART
+static bool valid_baud(int baud)
+{
+  static const int bauds[] = {9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+  for (unsigned int i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++)
+    if (baud == bauds[i])
+      return true;
+  return false;
+}
+
+// Host receive time, same clock as ros::WallTime
+static int64_t now_ns()
+{
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// For measuring durations, immune to clock steps
+static double monotonic_seconds()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+Gx3Driver::Config::Config() :
+  baud(115200),
+  target_baud(0),
+  rate(0),
+  preset(DEFAULT_PRESET),
+  read_timeout(1.0),
+  reset_timer(true),
+  handshake_timeout(0.5),
+  quick_start(true),
+  reconnect(true),
+  reconnect_delay(0.1),
+  reconnect_max_delay(5.0),
+  low_latency(false),
+  vmin(1),
+  vtime(0),
+  read_chunk(4096),
+  polled(false),
+  filter_window(0),
+  mag_filter_window(0),
+  coning_sculling(-1),
+  capture_gyro_bias(0.0),
+  persist(false)
+{
+}
+
+Gx3Driver::Gx3Driver(boost::asio::io_service &io_service) :
+  io_service_(io_service),
+  strand_(io_service),
+  port_(io_service),
+  deadline_(io_service),
+  preset_(find_preset(DEFAULT_PRESET)),
+  parser_(preset_->command, preset_->length),
+  read_buffer_(Config().read_chunk),
+  data_(MAX_FRAME_LENGTH),
+  t0_(0),
+  replay_rate_(0.0),
+  replay_timer_(io_service),
+  replay_start_(0.0),
+  replay_first_(-1),
+  reads_(0),
+  bytes_read_(0),
+  last_data_(0.0),
+  last_sync_warning_(-1e9),
+  stopped_(true),
+  poll_cmd_(DEFAULT_PRESET),
+  polls_(0),
+  poll_misses_(0),
+  gyro_bias_captured_(false),
+  sampling_stored_(false),
+  baud_stored_(false),
+  reconnect_timer_(io_service),
+  reconnect_delay_(0.1),
+  reconnecting_(false),
+  reconnects_(0)
+{
+  for (int i = 0; i < 3; i++)
+    captured_gyro_bias_[i] = 0.0f;
+}
+
+Gx3Driver::~Gx3Driver()
+{
+  if (reconnect_thread_.joinable())
+    reconnect_thread_.join();
+  capture_.close();
+}
+
+void Gx3Driver::log(LogLevel level, const char *format, ...)
+{
+  char message[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+
+  if (log_callback_)
+    log_callback_(level, message);
+  else
+    fprintf(stderr, "%s\n", message);
+}
+
+bool Gx3Driver::open_port(int baud)
+{
+  try
+    {
+      port_.open(config_.port);
+    }
+  catch (boost::system::system_error &error)
+    {
+      log(LOG_ERROR, "Failed to open port %s with error %s",
+          config_.port.c_str(), error.what());
+      return false;
+    }
+
+  if (!port_.is_open())
+    {
+      log(LOG_ERROR, "failed to open serial port %s", config_.port.c_str());
+      return false;
+    }
+
+  typedef boost::asio::serial_port_base sb;
+
+  sb::baud_rate baud_option(baud);
+  sb::flow_control flow_control(sb::flow_control::none);
+  sb::parity parity(sb::parity::none);
+  sb::stop_bits stop_bits(sb::stop_bits::one);
+
+  port_.set_option(baud_option);
+  port_.set_option(flow_control);
+  port_.set_option(parity);
+  port_.set_option(stop_bits);
+
+  return true;
+}
+
+void Gx3Driver::close_port()
+{
+  boost::system::error_code ignored;
+  if (port_.is_open())
+    port_.close(ignored);
+}
+
+bool Gx3Driver::send_command(const char *cmd, size_t cmd_length,
+                             unsigned char *reply, size_t reply_length,
+                             double timeout)
+{
+  boost::asio::write(port_, boost::asio::buffer(cmd, cmd_length));
+  if (!read_reply(reply, reply_length, timeout > 0.0 ? timeout : config_.handshake_timeout))
+    {
+      log(LOG_WARN, "no reply to command 0x%02X", (unsigned char)cmd[0]);
+      return false;
+    }
+  return validate_checksum(reply, reply_length);
+}
+
+bool Gx3Driver::changes_sampling() const
+{
+  return config_.rate > 0 || config_.filter_window > 0 ||
+    config_.mag_filter_window > 0 || config_.coning_sculling >= 0;
+}
+
+bool Gx3Driver::set_sampling()
+{
+  // Sampling Settings, read the current values first so that only the
+  // configured ones are changed. The reply carries the decimation, the
+  // data conditioning flags and the gyro/accelerometer and magnetometer
+  // filter window sizes, followed by values left as they are.
+  unsigned char cmd[SAMPLING_CMD_LENGTH] = {0xDB, 0xA8, 0xB9, 0x00};
+  unsigned char reply[SAMPLING_REPLY_LENGTH];
+  if (!send_command((const char*)cmd, SAMPLING_CMD_LENGTH, reply, SAMPLING_REPLY_LENGTH))
+    {
+      log(LOG_ERROR, "failed to read sampling settings");
+      return false;
+    }
+
+  memcpy(cmd + 4, reply + 1, SAMPLING_REPLY_LENGTH - 3);
+  if (config_.rate > 0)
+    encode_be16(BASE_RATE / config_.rate, cmd + 4);
+  if (config_.coning_sculling >= 0)
+    {
+      uint16_t flags = decode_be16(cmd + 6);
+      if (config_.coning_sculling)
+        flags |= CONING_SCULLING_FLAG;
+      else
+        flags &= ~CONING_SCULLING_FLAG;
+      encode_be16(flags, cmd + 6);
+    }
+  if (config_.filter_window > 0)
+    cmd[8] = (unsigned char)config_.filter_window;
+  if (config_.mag_filter_window > 0)
+    cmd[9] = (unsigned char)config_.mag_filter_window;
+
+  // Nothing to write, and in particular no EEPROM cycle to spend, once
+  // the device runs with the settings. With persist they are stored once
+  // anyway: a run without it may have set them only until power off.
+  if (memcmp(cmd + 4, reply + 1, SAMPLING_REPLY_LENGTH - 3) == 0 &&
+      (!config_.persist || sampling_stored_))
+    {
+      log(LOG_INFO, "sampling settings already in effect");
+      return true;
+    }
+
+  // Change the values, storing them in EEPROM if asked to
+  cmd[3] = config_.persist ? 0x02 : 0x01;
+
+  // The device answers with the settings now in effect
+  if (!send_command((const char*)cmd, SAMPLING_CMD_LENGTH, reply, SAMPLING_REPLY_LENGTH))
+    {
+      log(LOG_ERROR, "failed to change sampling settings");
+      return false;
+    }
+  if (memcmp(reply + 1, cmd + 4, 6) != 0)
+    {
+      log(LOG_ERROR, "device did not take the sampling settings");
+      return false;
+    }
+  sampling_stored_ = config_.persist;
+
+  uint16_t decimation = decode_be16(reply + 1);
+  log(LOG_INFO, "data rate %d Hz, filter windows %d (gyro/accel) and %d (magnetometer), coning & sculling %s%s",
+      BASE_RATE / decimation, reply[5], reply[6],
+      (decode_be16(reply + 3) & CONING_SCULLING_FLAG) ? "on" : "off",
+      config_.persist ? ", stored in EEPROM" : "");
+  return true;
+}
+
+// The device averages its gyro output over the sampling time before it
+// answers with the bias, which it subtracts from then on until power off
+bool Gx3Driver::capture_gyro_bias()
+{
+  uint16_t ms = (uint16_t)(config_.capture_gyro_bias * 1e3 + 0.5);
+  unsigned char cmd[BIAS_CMD_LENGTH] = {0xCD, 0xC1, 0x29};
+  encode_be16(ms, cmd + 3);
+  unsigned char reply[BIAS_REPLY_LENGTH];
+
+  log(LOG_INFO, "capturing gyro bias over %.1f s, keep the device still",
+      config_.capture_gyro_bias);
+  if (!send_command((const char*)cmd, BIAS_CMD_LENGTH, reply, BIAS_REPLY_LENGTH,
+                    config_.capture_gyro_bias + config_.handshake_timeout) ||
+      reply[0] != 0xCD)
+    {
+      log(LOG_ERROR, "failed to capture gyro bias");
+      return false;
+    }
+
+  uint32_t words[3];
+  decode_be32(reply + 1, 3, words);
+  memcpy(captured_gyro_bias_, words, sizeof(captured_gyro_bias_));
+  gyro_bias_captured_ = true;
+  log(LOG_INFO, "gyro bias %.5f %.5f %.5f rad/s", captured_gyro_bias_[0],
+      captured_gyro_bias_[1], captured_gyro_bias_[2]);
+  return true;
+}
+
+bool Gx3Driver::set_baud()
+{
+  // Communication Settings for the primary UART, read the current port
+  // configuration first so that only the baud rate is changed
+  unsigned char cmd[COMM_CMD_LENGTH] = {0xD9, 0xC3, 0x55, 0x01, 0x00};
+  unsigned char reply[COMM_REPLY_LENGTH];
+  if (!send_command((const char*)cmd, COMM_CMD_LENGTH, reply, COMM_REPLY_LENGTH))
+    {
+      log(LOG_ERROR, "failed to read communication settings");
+      return false;
+    }
+
+  if ((int)decode_be32(reply + 1) == config_.target_baud && (!config_.persist || baud_stored_))
+    return true;
+
+  // The device answers at the old rate and switches afterwards
+  cmd[4] = config_.persist ? 0x02 : 0x01;
+  encode_be32(config_.target_baud, cmd + 5);
+  cmd[9] = reply[5];
+  if (!send_command((const char*)cmd, COMM_CMD_LENGTH, reply, COMM_REPLY_LENGTH))
+    {
+      log(LOG_ERROR, "failed to set baud rate to %d", config_.target_baud);
+      return false;
+    }
+
+  // Follow on the host side and make sure the device is still talking to
+  // us. It needs a moment to switch, so give it a few tries.
+  port_.set_option(boost::asio::serial_port_base::baud_rate(config_.target_baud));
+
+  char mode[4] = {'\xD4','\xA3','\x47','\x00'};
+  unsigned char mode_reply[REPLY_LENGTH];
+  bool answered = false;
+  for (int i = 0; i < 3 && !answered; i++)
+    {
+      drain();
+      answered = send_command(mode, MODE_CMD_LENGTH, mode_reply, REPLY_LENGTH);
+    }
+  if (!answered)
+    {
+      log(LOG_ERROR, "no answer after switching to %d baud", config_.target_baud);
+      return false;
+    }
+  baud_stored_ = config_.persist;
+
+  log(LOG_INFO, "link running at %d baud%s", config_.target_baud,
+      config_.persist ? ", stored in EEPROM" : "");
+  return true;
+}
+
+bool Gx3Driver::open(const Config &config)
+{
+  replay_.close();
+  config_ = config;
+  source_ = config_.port;
+  read_timeout_ = boost::posix_time::microseconds((long)(config_.read_timeout * 1e6));
+
+  preset_ = find_preset(config_.preset);
+  if (!preset_)
+    {
+      log(LOG_ERROR, "unknown preset 0x%02X", config_.preset);
+      preset_ = find_preset(DEFAULT_PRESET);
+      return false;
+    }
+  // The ring holds a whole read on top of a partial frame left over
+  read_buffer_.resize(std::max(config_.read_chunk, (int)MAX_FRAME_LENGTH));
+  parser_ = FrameParser(preset_->command, preset_->length, 2 * read_buffer_.size());
+  poll_cmd_ = preset_->command;
+
+  if (config_.port.empty())
+    {
+      log(LOG_ERROR, "must provide a port");
+      return false;
+    }
+
+  // Settings errors are not worth retrying, so check them before talking
+  // to the device
+  if (config_.rate != 0 && (config_.rate < 1 || config_.rate > BASE_RATE))
+    {
+      log(LOG_ERROR, "rate must be between 1 and %d Hz", BASE_RATE);
+      return false;
+    }
+
+  if (config_.target_baud != 0 && !valid_baud(config_.target_baud))
+    {
+      log(LOG_ERROR, "unsupported target_baud %d", config_.target_baud);
+      return false;
+    }
+
+  if (config_.filter_window > MAX_FILTER_WINDOW || config_.mag_filter_window > MAX_FILTER_WINDOW)
+    {
+      log(LOG_ERROR, "filter windows must be between 1 and %d samples", MAX_FILTER_WINDOW);
+      return false;
+    }
+
+  if (config_.capture_gyro_bias < 0.0 || config_.capture_gyro_bias > 65.535)
+    {
+      log(LOG_ERROR, "gyro bias capture time must be at most 65.535 s");
+      return false;
+    }
+
+  int link_baud = config_.target_baud > 0 ? config_.target_baud : config_.baud;
+  if (!config_.polled && config_.rate > 0 &&
+      config_.rate * (int)preset_->length * 10 > link_baud)
+    log(LOG_WARN, "%d Hz needs more than %d baud, expect dropped samples",
+        config_.rate, link_baud);
+
+  reconnect_delay_ = config_.reconnect_delay;
+  if (connect(config_.reset_timer))
+    return true;
+
+  // The device may just not be plugged in yet
+  if (config_.reconnect)
+    {
+      log(LOG_WARN, "device not ready, retrying once streaming starts");
+      return true;
+    }
+  return false;
+}
+
+bool Gx3Driver::connect(bool reset_timer)
+{
+  // A device left streaming by a previous run talks at the link rate
+  int link_baud = config_.target_baud > 0 ? config_.target_baud : config_.baud;
+  if (!open_port(link_baud))
+    return false;
+
+  try
+    {
+      if (can_quick_start() && detect_stream())
+        log(LOG_INFO, "device already streaming preset 0x%02X, configuration skipped",
+            preset_->command);
+      else if (!configure())
+        {
+          close_port();
+          return false;
+        }
+
+      if (reset_timer)
+        {
+          write_timer_reset();
+          read_timer_reset();
+        }
+    }
+  catch (boost::system::system_error &error)
+    {
+      log(LOG_ERROR, "device handshake failed with error %s", error.what());
+      close_port();
+      return false;
+    }
+
+  return true;
+}
+
+bool Gx3Driver::configure()
+{
+  typedef boost::asio::serial_port_base sb;
+  int link_baud = config_.target_baud > 0 ? config_.target_baud : config_.baud;
+
+  char mode[4] = {'\xD4','\xA3','\x47','\x00'}; // mode cmd array, default to read current mode
+  unsigned char reply[REPLY_LENGTH];
+
+  // A device that stored the link speed boots at it, otherwise it is
+  // most likely fresh from a power cycle at the initial rate
+  int first_baud = config_.persist ? link_baud : config_.baud;
+  int second_baud = config_.persist ? config_.baud : link_baud;
+
+  // Stop continous mode if it is running
+  port_.set_option(sb::baud_rate(first_baud));
+  boost::asio::write(port_, boost::asio::buffer(stop_cmd, STOP_CMD_LENGTH));
+  drain();
+
+  // Check the mode
+  if (!send_command(mode, MODE_CMD_LENGTH, reply, REPLY_LENGTH))
+    {
+      if (second_baud == first_baud)
+        {
+          log(LOG_ERROR, "failed to get mode");
+          return false;
+        }
+
+      // The device may still run at the rate a previous start negotiated
+      log(LOG_WARN, "no answer at %d baud, trying %d", first_baud, second_baud);
+      port_.set_option(sb::baud_rate(second_baud));
+      boost::asio::write(port_, boost::asio::buffer(stop_cmd, STOP_CMD_LENGTH));
+      drain();
+
+      // Check the mode
+      if (!send_command(mode, MODE_CMD_LENGTH, reply, REPLY_LENGTH))
+        {
+          log(LOG_ERROR, "failed to get mode");
+          return false;
+        }
+    }
+
+  // If we are not in active mode, change it
+  if (reply[1] != 0x01)
+    {
+      mode[3] = '\x01';
+      if (!send_command(mode, MODE_CMD_LENGTH, reply, REPLY_LENGTH))
+        {
+          log(LOG_ERROR, "failed to set mode to active");
+          return false;
+        }
+    }
+
+  if (changes_sampling() && !set_sampling())
+    return false;
+
+  // Only once: after a reconnect the device may be moving, so it keeps
+  // whatever bias it has
+  if (config_.capture_gyro_bias > 0.0 && !gyro_bias_captured_ && !capture_gyro_bias())
+    return false;
+
+  if (config_.target_baud > 0 && !set_baud())
+    return false;
+
+  // In active mode every preset command byte is answered with one frame
+  if (config_.polled)
+    return true;
+
+  // Set the continous preset mode, by default 0xCC (Acceleration, Angular Rate & Magnetometer Vectors & Orientation Matrix)
+  // More detail in '3DM-GX3-25 Single Byte Data Communications Protocol' p21
+  const char preset[4] = {'\xD6','\xC6','\x6B',(char)preset_->command};
+  if (!send_command(preset, 4, reply, REPLY_LENGTH))
+    {
+      log(LOG_ERROR, "failed to set continuous mode preset");
+      return false;
+    }
+
+  // Set the mode to continous output
+  mode[3] = '\x02';
+  if (!send_command(mode, MODE_CMD_LENGTH, reply, REPLY_LENGTH))
+    {
+      log(LOG_ERROR, "failed to set mode to continuous output");
+      return false;
+    }
+
+  return true;
+}
+
+// The stream shows the preset and the rate, nothing else. Settings that
+// have to be sent to be sure of them rule the shortcut out.
+bool Gx3Driver::can_quick_start() const
+{
+  if (!config_.quick_start || config_.polled)
+    return false;
+  if (config_.filter_window > 0 || config_.mag_filter_window > 0 || config_.coning_sculling >= 0)
+    return false;
+  // Settings that are only in effect may still have to be stored
+  if (config_.persist && ((changes_sampling() && !sampling_stored_) ||
+                          (config_.target_baud > 0 && !baud_stored_)))
+    return false;
+  return config_.capture_gyro_bias <= 0.0 || gyro_bias_captured_;
+}
+
+// Listen for a moment: after a restart of the host side the device may
+// still be streaming the wanted preset at the wanted rate, and then there
+// is nothing to configure
+bool Gx3Driver::detect_stream()
+{
+  FrameParser parser(preset_->command, preset_->length);
+  std::vector<unsigned char> frame(preset_->length);
+  unsigned char buffer[256];
+  uint32_t last_timer = 0;
+  int frames = 0;
+
+  // Ticks between two frames at the configured rate, 10 % tolerance
+  double expected = config_.rate > 0 ? TICK_RATE / output_rate() : 0.0;
+
+  // An idle device should not hold up the handshake, so give up after a
+  // short silence; slow streams just get configured again
+  double deadline = monotonic_seconds() + config_.handshake_timeout;
+  while (frames < 3)
+    {
+      double left = deadline - monotonic_seconds();
+      size_t length = left > 0.0 ? read_some(buffer, sizeof(buffer), std::min(left, 0.1)) : 0;
+      if (length == 0)
+        return false;
+
+      parser.feed(buffer, length);
+      while (parser.next(&frame[0]))
+        {
+          Sample sample;
+          decode_frame(*preset_, &frame[0], sample);
+          if (frames > 0 && expected > 0.0 &&
+              fabs((double)(uint32_t)(sample.timer - last_timer) - expected) > 0.1 * expected)
+            return false;
+          last_timer = sample.timer;
+          frames++;
+        }
+    }
+  return true;
+}
+
+// Wait at most 'timeout' seconds for data and return what is there, 0 if
+// nothing arrived
+size_t Gx3Driver::read_some(unsigned char *data, size_t length, double timeout)
+{
+  int fd = port_.native_handle();
+  double deadline = monotonic_seconds() + timeout;
+  while (true)
+    {
+      double left = deadline - monotonic_seconds();
+      if (left <= 0.0)
+        return 0;
+
+      pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      int ready = ::poll(&pfd, 1, (int)(left * 1e3) + 1);
+      if (ready < 0 && errno == EINTR)
+        continue;
+      if (ready < 0)
+        throw boost::system::system_error(errno, boost::system::system_category(), "poll");
+      if (ready == 0)
+        return 0;
+
+      ssize_t n = ::read(fd, data, length);
+      if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        continue;
+      if (n < 0)
+        throw boost::system::system_error(errno, boost::system::system_category(), "read");
+      if (n == 0)
+        throw boost::system::system_error(boost::asio::error::eof, "read");
+      return n;
+    }
+}
+
+// Read a complete reply or give up after 'timeout'
+bool Gx3Driver::read_reply(unsigned char *reply, size_t length, double timeout)
+{
+  double deadline = monotonic_seconds() + timeout;
+  size_t received = 0;
+  while (received < length)
+    {
+      double left = deadline - monotonic_seconds();
+      size_t n = left > 0.0 ? read_some(reply + received, length - received, left) : 0;
+      if (n == 0)
+        return false;
+      received += n;
+    }
+  return true;
+}
+
+// Discard whatever the device still sends until the line has been quiet
+// for a moment, instead of sleeping for a fixed time
+void Gx3Driver::drain()
+{
+  unsigned char buffer[256];
+  double deadline = monotonic_seconds() + config_.handshake_timeout;
+  while (read_some(buffer, sizeof(buffer), 0.02) > 0 && monotonic_seconds() < deadline)
+    ;
+  tcflush(port_.native_handle(), TCIFLUSH);
+}
+
+// The device restarts its timer once the command has arrived, which is
+// the time the write returns plus the time the bytes take on the wire
+void Gx3Driver::write_timer_reset()
+{
+  boost::asio::write(port_, boost::asio::buffer(set_timer_cmd, TIMER_CMD_LENGTH));
+  int baud = config_.target_baud > 0 ? config_.target_baud : config_.baud;
+  t0_ = now_ns() + (int64_t)TIMER_CMD_LENGTH * 10 * 1000000000LL / baud;
+}
+
+// While streaming the reply is interleaved with data frames; the parser
+// skips whatever is left of it
+void Gx3Driver::read_timer_reset()
+{
+  unsigned char reply[TIMER_REPLY_LENGTH];
+  read_reply(reply, TIMER_REPLY_LENGTH, config_.handshake_timeout);
+}
+
+bool Gx3Driver::reset_timer()
+{
+  std::vector<Gx3Driver*> drivers(1, this);
+  return reset_timers(drivers);
+}
+
+bool Gx3Driver::reset_timers(const std::vector<Gx3Driver*> &drivers)
+{
+  std::vector<Gx3Driver*> open;
+  for (size_t i = 0; i < drivers.size(); i++)
+    if (drivers[i]->port_.is_open() && !drivers[i]->replay_.is_open())
+      open.push_back(drivers[i]);
+  if (open.empty())
+    return true;
+
+  // Commands first and replies afterwards, so the resets are only apart
+  // by the time a write takes
+  int64_t first = 0, spread = 0;
+  std::vector<bool> written(open.size(), false);
+  bool ok = true;
+  for (size_t i = 0; i < open.size(); i++)
+    {
+      try
+        {
+          open[i]->write_timer_reset();
+          written[i] = true;
+        }
+      catch (boost::system::system_error &error)
+        {
+          open[i]->log(LOG_ERROR, "failed to reset timer: %s", error.what());
+          ok = false;
+          continue;
+        }
+      if (first == 0)
+        first = open[i]->t0_;
+      spread = open[i]->t0_ - first;
+    }
+
+  // Halfway between the first and the last reset
+  int64_t t0 = first + spread / 2;
+
+  for (size_t i = 0; i < open.size(); i++)
+    {
+      if (!written[i])
+        continue;
+      try
+        {
+          open[i]->read_timer_reset();
+        }
+      catch (boost::system::system_error &error)
+        {
+          open[i]->log(LOG_ERROR, "no answer to timer reset: %s", error.what());
+          ok = false;
+        }
+      open[i]->t0_ = t0;
+    }
+
+  if (open.size() > 1)
+    open[0]->log(LOG_INFO, "reset %d device timers within %.0f us",
+                 (int)open.size(), spread * 1e-3);
+  return ok;
+}
+
+bool Gx3Driver::open_replay(const std::string &path, double rate)
+{
+  if (!replay_.open(path))
+    {
+      log(LOG_ERROR, "failed to open raw log %s", path.c_str());
+      return false;
+    }
+
+  // The log knows what the device was streaming and when its timer started
+  const Preset *preset = find_preset(replay_.header().preset);
+  if (!preset)
+    {
+      log(LOG_ERROR, "raw log %s has unknown preset 0x%02X", path.c_str(),
+          replay_.header().preset);
+      replay_.close();
+      return false;
+    }
+  preset_ = preset;
+  parser_ = FrameParser(preset_->command, preset_->length, 2 * read_buffer_.size());
+  config_.preset = preset_->command;
+  source_ = path;
+  t0_ = replay_.header().t0;
+  replay_rate_ = rate;
+
+  log(LOG_INFO, "replaying %s", path.c_str());
+  return true;
+}
+
+bool Gx3Driver::open_capture(const std::string &path)
+{
+  RawLogHeader header;
+  header.preset = preset_->command;
+  header.t0 = t0_;
+  if (!capture_.open(path, header))
+    {
+      log(LOG_ERROR, "failed to open raw log %s for writing", path.c_str());
+      return false;
+    }
+  log(LOG_INFO, "capturing raw data to %s", path.c_str());
+  return true;
+}
+
+double Gx3Driver::output_rate() const
+{
+  if (config_.polled || config_.rate < 1 || config_.rate > BASE_RATE)
+    return 0.0;
+  return (double)BASE_RATE / (BASE_RATE / config_.rate);
+}
+
+void Gx3Driver::start()
+{
+  stopped_ = false;
+
+  if (replay_.is_open())
+    {
+      replay_.rewind();
+      replay_start_ = monotonic_seconds();
+      replay_first_ = -1;
+      strand_.post(boost::bind(&Gx3Driver::replay_next, this));
+    }
+  else if (!port_.is_open() && config_.reconnect)
+    strand_.post(boost::bind(&Gx3Driver::begin_reconnect, this));
+  else
+    {
+      apply_stream_settings();
+      start_deadline();
+      start_read();
+    }
+}
+
+// Only once streaming: while the handshake waits for short replies a
+// large VMIN would hold them back
+void Gx3Driver::apply_stream_settings()
+{
+  int fd = port_.native_handle();
+
+  if (config_.low_latency)
+    {
+      serial_struct serial;
+      if (ioctl(fd, TIOCGSERIAL, &serial) < 0)
+        log(LOG_WARN, "cannot read serial settings: %s", strerror(errno));
+      else
+        {
+          serial.flags |= ASYNC_LOW_LATENCY;
+          if (ioctl(fd, TIOCSSERIAL, &serial) < 0)
+            log(LOG_WARN, "cannot set low latency mode: %s", strerror(errno));
+        }
+    }
+
+  int vmin = config_.vmin < 0 ? (int)preset_->length : config_.vmin;
+  if (vmin == 1 && config_.vtime == 0)
+    return;
+
+  termios tio;
+  if (tcgetattr(fd, &tio) < 0)
+    {
+      log(LOG_WARN, "cannot read terminal settings: %s", strerror(errno));
+      return;
+    }
+  tio.c_cc[VMIN] = (cc_t)std::min(vmin, 255);
+  tio.c_cc[VTIME] = (cc_t)std::min(std::max(config_.vtime, 0), 255);
+  if (tcsetattr(fd, TCSANOW, &tio) < 0)
+    log(LOG_WARN, "cannot set VMIN/VTIME: %s", strerror(errno));
+}
+
+void Gx3Driver::stop()
+{
+  if (stopped_)
+    return;
+  stopped_ = true;
+
+  boost::system::error_code ignored;
+  deadline_.cancel(ignored);
+  replay_timer_.cancel(ignored);
+  reconnect_timer_.cancel(ignored);
+  if (!reconnecting_)
+    port_.cancel(ignored);
+}
+
+void Gx3Driver::finish()
+{
+  stop();
+  if (stop_callback_)
+    stop_callback_();
+}
+
+void Gx3Driver::close()
+{
+  if (reconnect_thread_.joinable())
+    reconnect_thread_.join();
+  reconnecting_ = false;
+  capture_.close();
+  if (!port_.is_open())
+    return;
+
+  // Stop continous and close device once the command is out
+  boost::system::error_code ignored;
+  boost::asio::write(port_, boost::asio::buffer(stop_cmd, STOP_CMD_LENGTH), ignored);
+  tcdrain(port_.native_handle());
+  port_.close(ignored);
+}
+
+LatencyStats Gx3Driver::take_read_time()
+{
+  LatencyStats stats = read_time_;
+  read_time_.reset();
+  return stats;
+}
+
+LatencyStats Gx3Driver::take_poll_latency()
+{
+  LatencyStats stats = poll_latency_;
+  poll_latency_.reset();
+  return stats;
+}
+
+void Gx3Driver::poll()
+{
+  strand_.dispatch(boost::bind(&Gx3Driver::send_poll, this));
+}
+
+void Gx3Driver::send_poll()
+{
+  if (!config_.polled || replay_.is_open())
+    return;
+
+  int64_t now = now_ns();
+  expire_polls(now);
+  if (stopped_ || reconnecting_ || !port_.is_open() ||
+      pending_polls_.size() >= MAX_PENDING_POLLS)
+    {
+      poll_misses_++;
+      return;
+    }
+
+  // A single byte goes out in one write, so concurrent polls cannot
+  // interleave
+  pending_polls_.push_back(now);
+  polls_++;
+  boost::asio::async_write(port_, boost::asio::buffer(&poll_cmd_, 1),
+                           strand_.wrap(boost::bind(&Gx3Driver::handle_poll_write, this,
+                                                    boost::asio::placeholders::error)));
+}
+
+void Gx3Driver::handle_poll_write(const boost::system::error_code &error)
+{
+  if (stopped_ || !error || error == boost::asio::error::operation_aborted)
+    return;
+
+  // The read side notices a lost device as well, leave the recovery to it
+  log(LOG_WARN, "failed to send poll: %s", error.message().c_str());
+}
+
+// Replies that did not come within the handshake timeout never will
+void Gx3Driver::expire_polls(int64_t now)
+{
+  int64_t timeout = (int64_t)(config_.handshake_timeout * 1e9);
+  while (!pending_polls_.empty() && now - pending_polls_.front() > timeout)
+    {
+      pending_polls_.pop_front();
+      poll_misses_++;
+    }
+}
+
+// The deadline is armed once rather than with every read: rearming a
+// timer is a system call of its own, so handle_deadline() instead checks
+// when data last came in and waits out the rest
+void Gx3Driver::start_deadline()
+{
+  last_data_ = monotonic_seconds();
+  wait_deadline(read_timeout_);
+}
+
+void Gx3Driver::wait_deadline(const boost::posix_time::time_duration &wait)
+{
+  deadline_.expires_from_now(wait);
+  deadline_.async_wait(strand_.wrap(boost::bind(&Gx3Driver::handle_deadline, this,
+                                                boost::asio::placeholders::error)));
+}
+
+void Gx3Driver::start_read()
+{
+  port_.async_read_some(boost::asio::buffer(read_buffer_),
+                        strand_.wrap(boost::bind(&Gx3Driver::handle_read, this,
+                                                 boost::asio::placeholders::error,
+                                                 boost::asio::placeholders::bytes_transferred)));
+}
+
+void Gx3Driver::handle_read(const boost::system::error_code &error, size_t length)
+{
+  if (stopped_ || error == boost::asio::error::operation_aborted)
+    return;
+
+  if (error)
+    {
+      log(LOG_ERROR, "serial read failed: %s", error.message().c_str());
+      if (config_.reconnect)
+        begin_reconnect();
+      else
+        finish();
+      return;
+    }
+
+  int64_t received = now_ns();
+  IMU_3DM_GX3_TRACE_POINT(READ, received);
+  last_data_ = monotonic_seconds();
+  if (capture_.is_open() && !capture_.write(received, &read_buffer_[0], length))
+    {
+      log(LOG_ERROR, "failed to write raw log, capture stopped");
+      capture_.close();
+    }
+
+  process_bytes(&read_buffer_[0], length, received);
+
+  if (!stopped_)
+    start_read();
+}
+
+void Gx3Driver::process_bytes(const unsigned char *bytes, size_t length,
+                              int64_t received)
+{
+  // Let the parser find frame boundaries, so a dropped byte only costs
+  // the frame it belongs to
+  double handler_start = monotonic_seconds();
+  unsigned long discarded = parser_.bytes_discarded();
+  parser_.feed(bytes, length);
+  reads_++;
+  bytes_read_ += length;
+
+  while (parser_.next(&data_[0]))
+    {
+      IMU_3DM_GX3_TRACE_POINT(FRAME, received);
+      if (!pending_polls_.empty())
+        {
+          expire_polls(received);
+          if (!pending_polls_.empty())
+            {
+              poll_latency_.add((received - pending_polls_.front()) * 1e-9);
+              pending_polls_.pop_front();
+            }
+        }
+      if (frame_callback_)
+        frame_callback_(&data_[0], received);
+      if (sample_callback_)
+        {
+          Sample sample;
+          decode_frame(*preset_, &data_[0], sample);
+          sample_callback_(sample, received);
+        }
+    }
+
+  double handler_end = monotonic_seconds();
+
+  // Keep the log quiet under sustained errors
+  if (parser_.bytes_discarded() != discarded && handler_end - last_sync_warning_ >= 5.0)
+    {
+      log(LOG_WARN, "lost frame sync, %lu resyncs, %lu checksum failures, %lu bytes discarded so far",
+          parser_.resyncs(), parser_.checksum_failures(), parser_.bytes_discarded());
+      last_sync_warning_ = handler_end;
+    }
+
+  read_time_.add(handler_end - handler_start);
+}
+
+void Gx3Driver::replay_next()
+{
+  if (stopped_)
+    return;
+
+  int64_t received;
+  const unsigned char *bytes;
+  uint32_t length;
+  if (!replay_.next(received, bytes, length))
+    {
+      log(LOG_INFO, "replay finished");
+      finish();
+      return;
+    }
+
+  process_bytes(bytes, length, received);
+  if (stopped_)
+    return;
+
+  // Pace the next record by its recorded receive time, or go flat out
+  int64_t upcoming;
+  if (replay_rate_ > 0.0 && replay_.peek(upcoming))
+    {
+      if (replay_first_ < 0)
+        replay_first_ = received;
+      double offset = (upcoming - replay_first_) * 1e-9 / replay_rate_;
+      double wait = offset - (monotonic_seconds() - replay_start_);
+      if (wait > 0.0)
+        {
+          replay_timer_.expires_from_now(boost::posix_time::microseconds((long)(wait * 1e6)));
+          replay_timer_.async_wait(strand_.wrap(boost::bind(&Gx3Driver::handle_replay_timer, this,
+                                                            boost::asio::placeholders::error)));
+          return;
+        }
+    }
+
+  strand_.post(boost::bind(&Gx3Driver::replay_next, this));
+}
+
+void Gx3Driver::handle_replay_timer(const boost::system::error_code &error)
+{
+  if (stopped_ || error == boost::asio::error::operation_aborted)
+    return;
+  replay_next();
+}
+
+void Gx3Driver::handle_deadline(const boost::system::error_code &error)
+{
+  if (stopped_ || error == boost::asio::error::operation_aborted)
+    return;
+
+  double idle = monotonic_seconds() - last_data_;
+  if (idle < config_.read_timeout)
+    {
+      wait_deadline(boost::posix_time::microseconds((long)((config_.read_timeout - idle) * 1e6)));
+      return;
+    }
+
+  // A polled device is quiet until asked
+  if (config_.polled && pending_polls_.empty())
+    {
+      wait_deadline(read_timeout_);
+      return;
+    }
+
+  log(LOG_WARN, "no data received in %.3f s",
+      read_timeout_.total_microseconds() * 1e-6);
+
+  // A browned out device comes back idle, only a new handshake restarts it
+  if (config_.reconnect && !replay_.is_open())
+    {
+      begin_reconnect();
+      return;
+    }
+
+  wait_deadline(read_timeout_);
+}
+
+void Gx3Driver::begin_reconnect()
+{
+  if (stopped_ || reconnecting_)
+    return;
+
+  boost::system::error_code ignored;
+  deadline_.cancel(ignored);
+  port_.cancel(ignored);
+  close_port();
+  reconnecting_ = true;
+
+  log(LOG_WARN, "reconnecting in %.1f s", reconnect_delay_);
+  reconnect_timer_.expires_from_now(boost::posix_time::microseconds((long)(reconnect_delay_ * 1e6)));
+  reconnect_timer_.async_wait(strand_.wrap(boost::bind(&Gx3Driver::handle_reconnect_timer, this,
+                                                       boost::asio::placeholders::error)));
+}
+
+void Gx3Driver::handle_reconnect_timer(const boost::system::error_code &error)
+{
+  if (stopped_ || error == boost::asio::error::operation_aborted)
+    return;
+
+  if (reconnect_thread_.joinable())
+    reconnect_thread_.join();
+  reconnect_thread_ = boost::thread(boost::bind(&Gx3Driver::reconnect_attempt, this));
+}
+
+// After a power cycle the device timer restarts on its own, so the timer
+// is always reset here, even if the devices were aligned at startup
+void Gx3Driver::reconnect_attempt()
+{
+  bool connected = connect(true);
+  strand_.post(boost::bind(&Gx3Driver::handle_reconnect_result, this, connected));
+}
+
+void Gx3Driver::handle_reconnect_result(bool connected)
+{
+  // A stopped driver leaves the port to close()
+  if (stopped_)
+    return;
+
+  if (!connected)
+    {
+      reconnecting_ = false;
+      reconnect_delay_ = std::min(2.0 * reconnect_delay_, config_.reconnect_max_delay);
+      begin_reconnect();
+      return;
+    }
+
+  reconnecting_ = false;
+  reconnects_++;
+  reconnect_delay_ = config_.reconnect_delay;
+  parser_.reset();
+  pending_polls_.clear();
+  log(LOG_INFO, "reconnected to %s", config_.port.c_str());
+  apply_stream_settings();
+  start_deadline();
+  start_read();
+}
+
+}
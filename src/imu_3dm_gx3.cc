@@ -1,77 +1,80 @@
 // Interface to the Microstrain 3DM-GX3-25
 // N. Michael
 
-#include <deque>
-#include <ros/ros.h>
-#include <sensor_msgs/Imu.h>
-#include <sensor_msgs/MagneticField.h>
-#include <tf/tf.h>
-#include <boost/asio.hpp>
-#include <boost/asio/serial_port.hpp>
-#include <eigen3/Eigen/Geometry> 
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <imu_3dm_gx3/imu_3dm_gx3.h>
+#include <imu_3dm_gx3/decode.h>
+#include <imu_3dm_gx3/orientation.h>
+#include <imu_3dm_gx3/realtime.h>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
 // #include "pose_utils.h"
 
 using namespace std;
 
-#define REPLY_LENGTH 4
-#define STOP_CMD_LENGTH 3
-#define MODE_CMD_LENGTH 4
-#define DATA_LENGTH 79
 #define GRAVITY_CONSTANT 9.807
+// Preallocated messages of the topics published once per window
+#define WINDOW_POOL_SIZE 16
+// Longer gaps between samples restart the orientation filter (s)
+#define MAX_FUSION_STEP 1.0
+// Longer steps back of the device timer, in sample periods, are a restart
+#define MAX_STEP_BACK 4
 
-boost::asio::serial_port* serial_port = 0;
-const char stop[3] = {'\xFA','\x75','\xB4'};  // stop continuous mode
-char mode[4] = {'\xD4','\xA3','\x47','\x00'}; // mode cmd array, default to read current mode
-unsigned char reply[REPLY_LENGTH];
-std::string name;
-
-void signal_handler(int signal){
-  if(ros::isInitialized() && ros::isStarted() && ros::ok() && !ros::isShuttingDown()){
-    boost::asio::write(*serial_port, boost::asio::buffer(stop, STOP_CMD_LENGTH));
-    ROS_WARN("Stop imu streaming!");
-    ros::Duration(0.1).sleep();
-    serial_port->close();
-    ROS_INFO("Serial port closed!");
-    ros::shutdown();
-  }
-}
+namespace imu_3dm_gx3
+{
 
-static float extract_float(unsigned char* addr)
+void configure_io_thread(const ros::NodeHandle &n, const std::string &name)
 {
-  float tmp;
+  bool lock;
+  int priority;
+  std::vector<int> cpus;
+  n.param("lock_memory", lock, false);
+  n.param("sched_priority", priority, 0);
+  n.getParam("cpu_affinity", cpus);
 
-  *((unsigned char*)(&tmp) + 3) = *(addr);
-  *((unsigned char*)(&tmp) + 2) = *(addr+1);
-  *((unsigned char*)(&tmp) + 1) = *(addr+2);
-  *((unsigned char*)(&tmp)) = *(addr+3);
+  if (lock && !lock_memory())
+    ROS_WARN("%s: mlockall failed: %s", name.c_str(), strerror(errno));
+
+  if (priority > 0)
+    {
+      if (set_thread_priority(priority))
+        ROS_INFO("%s: io thread running SCHED_FIFO at priority %d", name.c_str(), priority);
+      else
+        ROS_WARN("%s: cannot set SCHED_FIFO priority %d: %s", name.c_str(), priority,
+                 strerror(errno));
+    }
 
-  return tmp;
+  if (!cpus.empty() && !set_thread_affinity(cpus))
+    ROS_WARN("%s: cannot set cpu_affinity: %s", name.c_str(), strerror(errno));
 }
 
-static int extract_int(unsigned char* addr)
+// Diagonal covariance for a measurement with the given standard deviation,
+// or the "not available" marker
+static void set_covariance(bool available, double stdev, boost::array<double, 9> &cov)
 {
-  int tmp;
-
-  *((unsigned char*)(&tmp) + 3) = *(addr);
-  *((unsigned char*)(&tmp) + 2) = *(addr+1);
-  *((unsigned char*)(&tmp) + 1) = *(addr+2);
-  *((unsigned char*)(&tmp)) = *(addr+3);
-
-  return tmp;
+  cov.assign(0.0);
+  if (!available)
+    cov[0] = -1;
+  else
+    cov[0] = cov[4] = cov[8] = stdev * stdev;
 }
 
-bool validate_checksum(const unsigned char *data, unsigned short length)
+// Whether samples of 'preset' yield an orientation for the imu message
+static bool carries_orientation(const Preset &preset)
 {
-  unsigned short chksum = 0;
-  unsigned short rchksum = 0;
-
-  for (unsigned short i = 0; i < length - 2; i++)
-    chksum += data[i];
-
-  rchksum = data[length - 2] << 8;
-  rchksum += data[length - 1];
+  return preset.quaternion >= 0 || preset.euler >= 0 || preset.orientation_matrix >= 0;
+}
 
-  return (chksum == rchksum);
+// Covariance of the mean of 'samples' independent measurements; the
+// "not available" marker stays
+static void scale_covariance(double samples, boost::array<double, 9> &cov)
+{
+  if (cov[0] < 0.0)
+    return;
+  for (unsigned int i = 0; i < cov.size(); i++)
+    cov[i] /= samples;
 }
 
 inline void print_bytes(const unsigned char *data, unsigned short length)
@@ -81,238 +84,1249 @@ inline void print_bytes(const unsigned char *data, unsigned short length)
   puts("");
 }
 
-int main(int argc, char** argv)
+Imu3dmGx3::Imu3dmGx3(boost::asio::io_service &io_service, ros::NodeHandle &n,
+                     const std::string &name) :
+  n_(n),
+  name_(name),
+  driver_(io_service),
+  preset_(0),
+  estimate_bias_(false),
+  publish_running_(false),
+  publish_waiting_(false),
+  queue_high_water_(0),
+  queue_drops_(0),
+  track_sequence_(false),
+  last_ticks_(0),
+  decimation_(0),
+  dec_samples_(0),
+  dec_offset_(0.0),
+  dec_has_q_(false),
+  fuse_(false),
+  fusion_mag_(false),
+  updater_(ros::NodeHandle(), n),
+  min_freq_(0.0),
+  max_freq_(0.0),
+  diag_timer_(io_service),
+  last_frames_(0),
+  last_checksum_failures_(0),
+  last_resyncs_(0),
+  last_queue_drops_(0),
+  last_polls_(0),
+  last_dropped_(0),
+  published_(0),
+  pool_allocations_(0),
+  diag_dropped_(0),
+  diag_gaps_(0),
+  diag_duplicates_(0),
+  diag_bias_restarts_(0),
+  stopped_(false)
 {
+  n_.param("port", config_.port, string(""));
+  n_.param("baud", config_.baud, 115200);
+  n_.param("frame_id", frame_id_, string("imu"));
+  n_.param("delay", delay_, 0.0);
+  delay_duration_ = ros::Duration(delay_);
+
+  std::string stamp_mode;
+  n_.param("stamp_mode", stamp_mode, string("device"));
+  if (stamp_mode == "host")
+    stamp_mode_ = STAMP_HOST;
+  else if (stamp_mode == "filtered")
+    stamp_mode_ = STAMP_FILTERED;
+  else
+    {
+      if (stamp_mode != "device")
+        ROS_WARN("%s: unknown stamp_mode %s, using device", name_.c_str(), stamp_mode.c_str());
+      stamp_mode_ = STAMP_DEVICE;
+    }
 
-  signal(SIGINT,signal_handler);
-  ros::init(argc, argv, "imu_3dm_gx3", ros::init_options::NoSigintHandler);
-  ros::NodeHandle n("~");
+  double clock_window, clock_bucket;
+  n_.param("clock_window", clock_window, 60.0);
+  n_.param("clock_bucket", clock_bucket, 0.5);
+  clock_ = TimestampFilter(clock_window, clock_bucket);
 
-  name = ros::this_node::getName();
+  // Link speed and output rate to negotiate with the device at startup.
+  // Zero leaves the device setting untouched.
+  n_.param("target_baud", config_.target_baud, 0);
+  n_.param("rate", config_.rate, 0);
 
-  std::string port;
-  if (n.hasParam("port"))
-    n.getParam("port", port);
-  else
+  // Data preset, given as command byte (e.g. 0xC2) or by name
+  int preset_command;
+  std::string preset_name;
+  preset_ = find_preset(config_.preset);
+  if (n_.getParam("preset", preset_command))
+    preset_ = find_preset((unsigned char)preset_command);
+  else if (n_.getParam("preset", preset_name))
+    {
+      char *end;
+      long command = strtol(preset_name.c_str(), &end, 16);
+      preset_ = (*end == '\0') ? find_preset((unsigned char)command) : find_preset(preset_name);
+    }
+  if (preset_)
+    config_.preset = preset_->command;
+
+  // Frames buffered between the read and the publish thread
+  n_.param("queue_size", queue_size_, 256);
+
+  // Preallocated messages per topic
+  n_.param("message_pool", pool_size_, 256);
+
+  n_.param("read_timeout", config_.read_timeout, 1.0);
+
+  // Handshake replies time out, and a lost device is reopened in the
+  // background with exponential backoff
+  n_.param("handshake_timeout", config_.handshake_timeout, 0.5);
+  n_.param("quick_start", config_.quick_start, true);
+  n_.param("reconnect", config_.reconnect, true);
+  n_.param("reconnect_delay", config_.reconnect_delay, 0.1);
+  n_.param("reconnect_max_delay", config_.reconnect_max_delay, 5.0);
+
+  // Serial driver latency settings applied once streaming
+  n_.param("low_latency", config_.low_latency, false);
+  n_.param("vmin", config_.vmin, 1);
+  n_.param("vtime", config_.vtime, 0);
+  // Largest read, so a backlog is taken in a single system call
+  n_.param("read_chunk", config_.read_chunk, 4096);
+
+  // Filtering and gyro bias capture on the device, sent with the handshake
+  n_.param("filter_window", config_.filter_window, 0);
+  n_.param("mag_filter_window", config_.mag_filter_window, 0);
+  n_.param("coning_sculling", config_.coning_sculling, -1);
+  n_.param("capture_gyro_bias", config_.capture_gyro_bias, 0.0);
+
+  // Sampling settings and link speed survive a power cycle, so a swapped
+  // in device that was set up once starts without changes
+  n_.param("persist", config_.persist, false);
+
+  // Samples on request instead of a continuous stream
+  n_.param("polled", config_.polled, false);
+  n_.param("poll_gpio", poll_gpio_, string(""));
+
+  // Lost samples can be replaced by interpolated ones, marked as such on
+  // sample_info
+  n_.param("fill_gaps", fill_gaps_, false);
+  n_.param("max_fill_gap", max_fill_gap_, 10);
+
+  // Batching is off unless a sample count or a window length is given
+  n_.param("batch_size", batch_size_, 0);
+  n_.param("batch_period", batch_period_, 0.0);
+  batch_samples_ = 0;
+
+  // Low rate consumers get averages over this many samples, 0 for none
+  n_.param("decimation", decimation_, 0);
+
+  // Preintegration windows end on a period, on trigger stamps, or both.
+  // The default noise densities are the 3DM-GX3-25 datasheet figures.
+  double gyro_noise, accel_noise;
+  n_.param("preintegration_period", preint_period_, 0.0);
+  n_.param("preintegration_trigger", preint_trigger_, false);
+  n_.param("gyro_noise_density", gyro_noise, 5.2e-4);
+  n_.param("accel_noise_density", accel_noise, 7.8e-4);
+  preint_ = Preintegrator(gyro_noise, accel_noise);
+
+  // Host side orientation: "madgwick" with gain beta in rad/s or
+  // "complementary" with gain in 1/s, empty for none
+  string fusion;
+  double fusion_gain;
+  n_.param("fusion", fusion, string(""));
+  n_.param("fusion_gain", fusion_gain, 0.1);
+  n_.param("fusion_use_mag", fusion_mag_, true);
+  fuse_ = fusion == "madgwick" || fusion == "complementary";
+  if (!fuse_ && !fusion.empty())
+    ROS_WARN("%s: unknown fusion %s, not fusing", name_.c_str(), fusion.c_str());
+  fusion_ = OrientationFilter(fusion == "complementary" ? OrientationFilter::COMPLEMENTARY :
+                              OrientationFilter::MADGWICK, fusion_gain);
+
+  // Measurement noise reported in the message covariances, 0 leaves them
+  // unknown
+  n_.param("angular_velocity_stdev", ang_vel_stdev_, 0.0);
+  n_.param("linear_acceleration_stdev", accel_stdev_, 0.0);
+  n_.param("orientation_stdev", orientation_stdev_, 0.0);
+  n_.param("magnetic_field_stdev", mag_stdev_, 0.0);
+
+  // Gyro bias averaged over a window at rest after startup
+  double bias_time, bias_threshold;
+  n_.param("gyro_bias_estimation", bias_time, 0.0);
+  n_.param("gyro_bias_threshold", bias_threshold, 0.01);
+  estimate_bias_ = bias_time > 0.0;
+  bias_estimator_ = StaticBiasEstimator(bias_time, bias_threshold);
+  for (unsigned int i = 0; i < 3; i++)
+    {
+      gyro_bias_[i] = 0.0f;
+      diag_gyro_bias_[i] = 0.0;
+    }
+
+  // Raw capture of everything read from the port, and offline decoding of
+  // such a capture instead of talking to a device
+  n_.param("capture_file", capture_file_, string(""));
+
+  // Latency trace written on close, only in builds with tracepoints
+  n_.param("trace_file", trace_file_, string(""));
+  if (!trace_file_.empty() && !trace_enabled())
+    {
+      ROS_WARN("%s: built without IMU_3DM_GX3_TRACE, trace_file ignored", name_.c_str());
+      trace_file_.clear();
+    }
+  n_.param("replay_file", replay_file_, string(""));
+  n_.param("replay_rate", replay_rate_, 0.0);
+
+  double diag_period;
+  n_.param("diagnostic_period", diag_period, 1.0);
+  diag_period_ = boost::posix_time::microseconds((long)(diag_period * 1e6));
+
+  driver_.set_frame_callback(boost::bind(&Imu3dmGx3::handle_frame, this, _1, _2));
+  driver_.set_log_callback(boost::bind(&Imu3dmGx3::handle_log, this, _1, _2));
+  driver_.set_stop_callback(boost::bind(&Imu3dmGx3::stop, this));
+}
+
+void Imu3dmGx3::handle_log(Gx3Driver::LogLevel level, const std::string &message)
+{
+  switch (level)
     {
-      ROS_ERROR("%s: must provide a port", name.c_str());
-      return -1;
+    case Gx3Driver::LOG_ERROR:
+      ROS_ERROR("%s: %s", name_.c_str(), message.c_str());
+      break;
+    case Gx3Driver::LOG_WARN:
+      ROS_WARN("%s: %s", name_.c_str(), message.c_str());
+      break;
+    case Gx3Driver::LOG_INFO:
+    default:
+      ROS_INFO("%s: %s", name_.c_str(), message.c_str());
+      break;
     }
+}
 
-  boost::asio::io_service io_service;
-  serial_port = new boost::asio::serial_port(io_service);
+bool Imu3dmGx3::initialize(bool reset_timer)
+{
+  if (!preset_)
+    {
+      ROS_ERROR("%s: unknown preset", name_.c_str());
+      return false;
+    }
 
-  try
+  config_.reset_timer = reset_timer;
+  if (!replay_file_.empty())
     {
-      serial_port->open(port);
+      if (!driver_.open_replay(replay_file_, replay_rate_))
+        return false;
     }
-  catch (boost::system::system_error &error)
+  else if (!driver_.open(config_))
+    return false;
+
+  // A replay brings its own preset
+  preset_ = &driver_.preset();
+
+  // The capture header carries t0, so it waits for the timer reset
+  if (reset_timer && !open_capture())
     {
-      ROS_ERROR("%s: Failed to open port %s with error %s",
-                name.c_str(), port.c_str(), error.what());
-      return -1;
+      close();
+      return false;
     }
 
-  if (!serial_port->is_open())
+  ROS_INFO("%s: using preset 0x%02X (%s, %d bytes)", name_.c_str(),
+           preset_->command, preset_->name, (int)preset_->length);
+
+  set_covariance(preset_->ang_vel >= 0, ang_vel_stdev_, ang_vel_cov_);
+  set_covariance(preset_->accel >= 0, accel_stdev_, accel_cov_);
+  // Without orientation_stdev an orientation the preset carries is
+  // published with an all zero (unknown) covariance; one it does not
+  // carry is marked -1, so it is never taken for a perfect estimate
+  set_covariance(carries_orientation(*preset_), orientation_stdev_, orientation_cov_);
+  set_covariance(preset_->mag >= 0, mag_stdev_, mag_cov_);
+
+  if (estimate_bias_ && preset_->ang_vel < 0)
     {
-      ROS_ERROR("%s: failed to open serial port %s",
-                name.c_str(), port.c_str());
-      return -1;
+      ROS_WARN("%s: preset 0x%02X carries no angular rate, not estimating the gyro bias",
+               name_.c_str(), preset_->command);
+      estimate_bias_ = false;
     }
 
-  int baud;
-  n.param("baud", baud, 115200);
+  // Only advertise what the preset carries
+  if (preset_->accel >= 0 || preset_->ang_vel >= 0 || carries_orientation(*preset_))
+    imu_pub_ = n_.advertise<sensor_msgs::Imu>("imu", 100);
+  if (preset_->mag >= 0)
+    mag_pub_ = n_.advertise<sensor_msgs::MagneticField>("magnetic", 100);
+  if (preset_->orientation_matrix >= 0)
+    matrix_pub_ = n_.advertise<OrientationMatrix>("orientation_matrix", 100);
+  if (preset_->stab_accel >= 0)
+    stab_accel_pub_ = n_.advertise<geometry_msgs::Vector3Stamped>("stabilized_accel", 100);
+  if (preset_->stab_mag >= 0)
+    stab_mag_pub_ = n_.advertise<sensor_msgs::MagneticField>("stabilized_magnetic", 100);
+  // Polls come at any time, so there is no period to check against
+  track_sequence_ = !config_.polled;
+  if (track_sequence_)
+    {
+      sequence_ = SequenceTracker(driver_.output_rate() > 0.0 ?
+                                  Gx3Driver::TICK_RATE / driver_.output_rate() : 0.0);
+      info_pub_ = n_.advertise<SampleInfo>("sample_info", 100);
+    }
+  if (batch_size_ > 0 || batch_period_ > 0.0)
+    batch_pub_ = n_.advertise<ImuBatch>("imu_batch", 10);
+  if (decimation_ > 0 && imu_pub_)
+    dec_imu_pub_ = n_.advertise<sensor_msgs::Imu>("imu_decimated", 10);
+  if (decimation_ > 0 && mag_pub_)
+    dec_mag_pub_ = n_.advertise<sensor_msgs::MagneticField>("magnetic_decimated", 10);
+  if (preint_period_ > 0.0 || preint_trigger_)
+    {
+      if (preset_->accel >= 0 && preset_->ang_vel >= 0)
+        preint_pub_ = n_.advertise<ImuPreintegration>("imu_preintegrated", 10);
+      else
+        ROS_WARN("%s: preset 0x%02X carries no acceleration and angular rate, "
+                 "not preintegrating", name_.c_str(), preset_->command);
+    }
+  if (fuse_)
+    {
+      if (preset_->accel >= 0 && preset_->ang_vel >= 0)
+        fused_pub_ = n_.advertise<sensor_msgs::Imu>("imu_fused", 100);
+      else
+        ROS_WARN("%s: preset 0x%02X carries no acceleration and angular rate, "
+                 "not fusing", name_.c_str(), preset_->command);
+    }
+  fusion_mag_ = fusion_mag_ && preset_->mag >= 0;
+  if (preint_pub_ && preint_trigger_)
+    trigger_sub_ = n_.subscribe("preintegration_trigger", 10, &Imu3dmGx3::handle_trigger, this);
 
-  string frame_id;
-  n.param("frame_id", frame_id, string("imu"));
+  // Every message is allocated here; streaming only recycles them
+  if (imu_pub_)
+    imu_pool_.reset(pool_size_, boost::bind(&Imu3dmGx3::init_imu, this, _1));
+  if (mag_pub_)
+    mag_pool_.reset(pool_size_, boost::bind(&Imu3dmGx3::init_mag, this, _1));
+  if (matrix_pub_)
+    matrix_pool_.reset(pool_size_, boost::bind(&Imu3dmGx3::init_header<OrientationMatrix>, this, _1));
+  if (stab_accel_pub_)
+    stab_accel_pool_.reset(pool_size_,
+                           boost::bind(&Imu3dmGx3::init_header<geometry_msgs::Vector3Stamped>, this, _1));
+  if (stab_mag_pub_)
+    stab_mag_pool_.reset(pool_size_,
+                         boost::bind(&Imu3dmGx3::init_header<sensor_msgs::MagneticField>, this, _1));
+  if (info_pub_)
+    info_pool_.reset(pool_size_, boost::bind(&Imu3dmGx3::init_header<SampleInfo>, this, _1));
+  if (batch_pub_)
+    batch_pool_.reset(WINDOW_POOL_SIZE, boost::bind(&Imu3dmGx3::init_batch, this, _1));
+  if (preint_pub_)
+    preint_pool_.reset(WINDOW_POOL_SIZE, boost::bind(&Imu3dmGx3::init_header<ImuPreintegration>, this, _1));
+  if (fused_pub_)
+    fused_pool_.reset(pool_size_, boost::bind(&Imu3dmGx3::init_fused, this, _1));
+  if (dec_imu_pub_)
+    dec_imu_pool_.reset(WINDOW_POOL_SIZE, boost::bind(&Imu3dmGx3::init_decimated_imu, this, _1));
+  if (dec_mag_pub_)
+    dec_mag_pool_.reset(WINDOW_POOL_SIZE, boost::bind(&Imu3dmGx3::init_decimated_mag, this, _1));
 
-  double delay;
-  n.param("delay", delay, 0.0);
+  if (config_.polled && !driver_.replaying())
+    poll_sub_ = n_.subscribe("poll_trigger", 10, &Imu3dmGx3::handle_poll_trigger, this);
 
-  typedef boost::asio::serial_port_base sb;
+  updater_.setHardwareID(driver_.source());
+  updater_.add("Streaming", this, &Imu3dmGx3::diagnose);
+  if (driver_.output_rate() > 0.0)
+    {
+      // Tolerate 10 % around the configured output rate
+      min_freq_ = 0.9 * driver_.output_rate();
+      max_freq_ = 1.1 * driver_.output_rate();
+      freq_status_.reset(new diagnostic_updater::FrequencyStatus(
+          diagnostic_updater::FrequencyStatusParam(&min_freq_, &max_freq_)));
+      updater_.add(*freq_status_);
+    }
 
-  sb::baud_rate baud_option(baud);
-  sb::flow_control flow_control(sb::flow_control::none);
-  sb::parity parity(sb::parity::none);
-  sb::stop_bits stop_bits(sb::stop_bits::one);
+  return true;
+}
+
+bool Imu3dmGx3::open_capture()
+{
+  return capture_file_.empty() || driver_.open_capture(capture_file_);
+}
+
+bool Imu3dmGx3::reset_timers(const std::vector<Imu3dmGx3*> &imus)
+{
+  std::vector<Gx3Driver*> drivers;
+  for (size_t i = 0; i < imus.size(); i++)
+    drivers.push_back(&imus[i]->driver_);
+
+  bool ok = Gx3Driver::reset_timers(drivers);
+  for (size_t i = 0; i < imus.size(); i++)
+    ok = imus[i]->open_capture() && ok;
+  return ok;
+}
+
+void Imu3dmGx3::start()
+{
+  ROS_INFO("Streaming Data...");
+  stopped_ = false;
 
-  serial_port->set_option(baud_option);
-  serial_port->set_option(flow_control);
-  serial_port->set_option(parity);
-  serial_port->set_option(stop_bits);
+  driver_t0_.fromNSec(driver_.t0());
+  t0_ = driver_t0_;
+  stamp_base_ = t0_ - delay_duration_;
+  ticks_.reset();
+  clock_.reset();
 
-  // Stop continous mode if it is running
-  boost::asio::write(*serial_port, boost::asio::buffer(stop, STOP_CMD_LENGTH));
-  ROS_WARN("Wait 0.1s"); 
-  ros::Duration(0.1).sleep();
+  if (queue_size_ > 0)
+    {
+      queue_.reset(new boost::lockfree::spsc_queue<RawFrame>(queue_size_));
+      queue_high_water_ = 0;
+      queue_drops_ = 0;
+      publish_running_ = true;
+      publish_thread_ = boost::thread(boost::bind(&Imu3dmGx3::publish_loop, this));
+    }
 
-  // Check the mode
-  bool reInitFlag = false;
-  boost::asio::write(*serial_port, boost::asio::buffer(mode, MODE_CMD_LENGTH));
-  boost::asio::read(*serial_port, boost::asio::buffer(reply, REPLY_LENGTH));
-  if (!validate_checksum(reply, REPLY_LENGTH))
+  driver_.start();
+  start_diagnostics_timer();
+
+  // Edges poll straight from the trigger thread
+  if (config_.polled && !driver_.replaying() && !poll_gpio_.empty())
     {
-      ROS_ERROR("%s: failed to get mode", name.c_str());
-      if (serial_port->is_open())
-        serial_port->close();
-      reInitFlag = true;
+      if (edge_trigger_.start(poll_gpio_, boost::bind(&Gx3Driver::poll, &driver_)))
+        ROS_INFO("%s: polling on edges of %s", name_.c_str(), poll_gpio_.c_str());
+      else
+        ROS_ERROR("%s: cannot open %s: %s", name_.c_str(), poll_gpio_.c_str(), strerror(errno));
     }
+}
 
-  if (reInitFlag)
-  {
-    ROS_WARN("In Re-Init");
-    ros::Duration(0.1).sleep();
-    try
-      {
-        serial_port->open(port);
-      }
-    catch (boost::system::system_error &error)
-      {
-        ROS_ERROR("%s: Failed to open port %s with error %s",
-                  name.c_str(), port.c_str(), error.what());
-        return -1;
-      }
-    if (!serial_port->is_open())
+void Imu3dmGx3::stop()
+{
+  if (stopped_)
+    return;
+  stopped_ = true;
+
+  driver_.stop();
+  edge_trigger_.stop();
+  boost::system::error_code ignored;
+  diag_timer_.cancel(ignored);
+
+  if (publish_thread_.joinable())
+    {
+      publish_running_ = false;
       {
-        ROS_ERROR("%s: failed to open serial port %s",
-                  name.c_str(), port.c_str());
-        return -1;
+        boost::mutex::scoped_lock lock(publish_mutex_);
+        publish_cond_.notify_one();
       }
-    serial_port->set_option(baud_option);
-    serial_port->set_option(flow_control);
-    serial_port->set_option(parity);
-    serial_port->set_option(stop_bits);
-    // Check the mode
-    boost::asio::write(*serial_port, boost::asio::buffer(mode, 4));
-    boost::asio::read(*serial_port, boost::asio::buffer(reply, REPLY_LENGTH));
-    if (!validate_checksum(reply, REPLY_LENGTH))
-      {
-        ROS_ERROR("%s: failed to get mode", name.c_str());
-        if (serial_port->is_open())
-          serial_port->close();
-        return -1;
-      }    
+      publish_thread_.join();
+
+      ROS_INFO("%s: queue high water mark %lu of %d, %lu frames dropped",
+               name_.c_str(), (unsigned long)queue_high_water_, queue_size_,
+               queue_drops_);
+    }
+
+  if (stop_callback_)
+    stop_callback_();
+}
+
+void Imu3dmGx3::request_stop()
+{
+  driver_.strand().post(boost::bind(&Imu3dmGx3::stop, this));
+}
+
+void Imu3dmGx3::close()
+{
+  driver_.close();
+  if (!trace_file_.empty() && !write_trace(trace_file_))
+    ROS_ERROR("%s: failed to write trace %s", name_.c_str(), trace_file_.c_str());
+}
+
+void Imu3dmGx3::handle_frame(const unsigned char *data, int64_t received)
+{
+  ros::Time stamp, t0;
+  stamp.fromNSec(received);
+  t0.fromNSec(driver_.t0());
+  if (queue_)
+    push_frame(data, stamp, t0);
+  else
+    publish_frame(data, stamp, t0);
+}
+
+void Imu3dmGx3::start_diagnostics_timer()
+{
+  diag_timer_.expires_from_now(diag_period_);
+  diag_timer_.async_wait(driver_.strand().wrap(
+      boost::bind(&Imu3dmGx3::handle_diagnostics_timer, this,
+                  boost::asio::placeholders::error)));
+}
+
+void Imu3dmGx3::handle_diagnostics_timer(const boost::system::error_code &error)
+{
+  if (stopped_ || error == boost::asio::error::operation_aborted)
+    return;
+
+  if (!ros::ok())
+    {
+      stop();
+      return;
+    }
+
+  updater_.force_update();
+  start_diagnostics_timer();
+}
+
+void Imu3dmGx3::diagnose(diagnostic_updater::DiagnosticStatusWrapper &stat)
+{
+  const FrameParser &parser = driver_.parser();
+  unsigned long frames = parser.frames();
+  unsigned long checksum_failures = parser.checksum_failures();
+  unsigned long resyncs = parser.resyncs();
+  unsigned long dropped;
+  {
+    boost::mutex::scoped_lock lock(stats_mutex_);
+    dropped = diag_dropped_;
   }
 
-  // If we are not in active mode, change it
-  if (reply[2] != '\x01')
+  if (driver_.reconnecting())
+    stat.summary(diagnostic_msgs::DiagnosticStatus::ERROR, "Reconnecting");
+  else if (config_.polled && frames == last_frames_ && driver_.polls() == last_polls_)
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Waiting for polls");
+  else if (frames == last_frames_)
+    stat.summary(diagnostic_msgs::DiagnosticStatus::ERROR, "No data");
+  else if (checksum_failures != last_checksum_failures_ || resyncs != last_resyncs_)
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "Lost frame sync");
+  else if (queue_drops_ != last_queue_drops_)
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "Publish queue overflow");
+  else if (dropped != last_dropped_)
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "Samples dropped");
+  else
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Streaming");
+
+  last_frames_ = frames;
+  last_checksum_failures_ = checksum_failures;
+  last_resyncs_ = resyncs;
+  last_queue_drops_ = queue_drops_;
+  last_polls_ = driver_.polls();
+  last_dropped_ = dropped;
+
+  stat.addf("Preset", "0x%02X", preset_->command);
+  stat.add("Reconnects", driver_.reconnects());
+  stat.add("Reads", driver_.reads());
+  stat.add("Bytes read", driver_.bytes_read());
+  stat.add("Frames", frames);
+  stat.add("Checksum failures", checksum_failures);
+  stat.add("Resyncs", resyncs);
+  stat.add("Bytes discarded", parser.bytes_discarded());
+  stat.add("Queue size", queue_size_);
+  stat.add("Queue high water mark", (unsigned long)queue_high_water_);
+  stat.add("Queue drops", queue_drops_);
+  LatencyStats read_time = driver_.take_read_time();
+  stat.addf("Read handler mean (us)", "%.1f", read_time.mean() * 1e6);
+  stat.addf("Read handler max (us)", "%.1f", read_time.max * 1e6);
+  if (config_.polled)
+    {
+      LatencyStats poll_latency = driver_.take_poll_latency();
+      stat.add("Polls", driver_.polls());
+      stat.add("Poll misses", driver_.poll_misses());
+      stat.addf("Poll latency mean (us)", "%.1f", poll_latency.mean() * 1e6);
+      stat.addf("Poll latency max (us)", "%.1f", poll_latency.max * 1e6);
+    }
+  if (driver_.gyro_bias_captured())
+    {
+      const float *bias = driver_.captured_gyro_bias();
+      stat.addf("Device gyro bias (rad/s)", "%.5f %.5f %.5f", bias[0], bias[1], bias[2]);
+    }
+
+  boost::mutex::scoped_lock lock(stats_mutex_);
+  stat.add("Published", published_);
+  stat.add("Message allocations", pool_allocations_);
+  // Lost between the device and the publisher: compare with checksum
+  // failures and queue drops to tell the link from the node
+  stat.add("Dropped samples", diag_dropped_);
+  stat.add("Sample gaps", diag_gaps_);
+  stat.add("Duplicate samples", diag_duplicates_);
+  stat.addf("Publish latency mean (us)", "%.1f", publish_latency_.mean() * 1e6);
+  stat.addf("Publish latency max (us)", "%.1f", publish_latency_.max * 1e6);
+  publish_latency_.reset();
+  stat.addf("Gyro bias (rad/s)", "%.5f %.5f %.5f", diag_gyro_bias_[0],
+            diag_gyro_bias_[1], diag_gyro_bias_[2]);
+  stat.add("Gyro bias restarts", diag_bias_restarts_);
+
+  // Host receive intervals; frames that arrive in the same read land in
+  // the first bin
+  for (size_t i = 0; i < IntervalHistogram::BINS; i++)
     {
-      mode[3] = '\x01';
-      boost::asio::write(*serial_port, boost::asio::buffer(mode, 4));
-      boost::asio::read(*serial_port, boost::asio::buffer(reply, REPLY_LENGTH));
-      if (!validate_checksum(reply, REPLY_LENGTH))
+      char key[64];
+      if (i < IntervalHistogram::BINS - 1)
+        snprintf(key, sizeof(key), "Interval < %.1f ms", IntervalHistogram::upper_bound(i) * 1e3);
+      else
+        snprintf(key, sizeof(key), "Interval >= %.1f ms", IntervalHistogram::upper_bound(i - 1) * 1e3);
+      stat.add(key, intervals_.counts[i]);
+    }
+  intervals_.reset();
+}
+
+void Imu3dmGx3::push_frame(const unsigned char *data, const ros::Time &received,
+                           const ros::Time &t0)
+{
+  RawFrame frame;
+  memcpy(frame.data, data, preset_->length);
+  frame.received = received;
+  frame.t0 = t0;
+  if (!queue_->push(frame))
+    {
+      queue_drops_++;
+      ROS_WARN_THROTTLE(1.0, "%s: publish queue full, %lu frames dropped",
+                        name_.c_str(), queue_drops_);
+      return;
+    }
+
+  size_t used = queue_size_ - queue_->write_available();
+  if (used > queue_high_water_)
+    queue_high_water_ = used;
+
+  // Pairs with the fence in publish_loop(): either the consumer sees the
+  // new frame or we see that it is about to sleep
+  boost::atomic_thread_fence(boost::memory_order_seq_cst);
+  if (publish_waiting_)
+    {
+      boost::mutex::scoped_lock lock(publish_mutex_);
+      publish_cond_.notify_one();
+    }
+}
+
+void Imu3dmGx3::publish_loop()
+{
+  RawFrame frame;
+  while (publish_running_)
+    {
+      while (queue_->pop(frame))
+        publish_frame(frame.data, frame.received, frame.t0);
+
+      boost::mutex::scoped_lock lock(publish_mutex_);
+      publish_waiting_ = true;
+      boost::atomic_thread_fence(boost::memory_order_seq_cst);
+      if (publish_running_ && queue_->read_available() == 0)
+        publish_cond_.timed_wait(lock, boost::posix_time::milliseconds(100));
+      publish_waiting_ = false;
+    }
+
+  // Whatever was read before stop() still gets published
+  while (queue_->pop(frame))
+    publish_frame(frame.data, frame.received, frame.t0);
+}
+
+ros::Time Imu3dmGx3::stamp_sample(uint64_t ticks, const ros::Time &received)
+{
+  // Seconds since the timer reset
+  double T = ticks / Gx3Driver::TICK_RATE;
+
+  switch (stamp_mode_)
+    {
+    case STAMP_HOST:
+      return received - delay_duration_;
+    case STAMP_FILTERED:
+      return stamp_base_ + ros::Duration(clock_.update(T, (received - t0_).toSec()));
+    case STAMP_DEVICE:
+    default:
+      return stamp_base_ + ros::Duration(T);
+    }
+}
+
+void Imu3dmGx3::restart_timer(const ros::Time &t0)
+{
+  t0_ = t0;
+  stamp_base_ = t0_ - delay_duration_;
+  clock_.reset();
+  sequence_.restart();
+  preint_last_ = ros::Time();
+  fusion_last_ = ros::Time();
+}
+
+void Imu3dmGx3::publish_frame(const unsigned char *data, const ros::Time &received,
+                              const ros::Time &t0)
+{
+  // The device timer was reset by a reconnect
+  if (t0 != driver_t0_)
+    {
+      driver_t0_ = t0;
+      restart_timer(t0);
+      ticks_.reset();
+    }
+
+  Sample sample;
+  decode_frame(*preset_, data, sample);
+  IMU_3DM_GX3_TRACE_POINT(DECODE, received.toNSec());
+
+  // Repeated and reordered samples step back a period or two, of the
+  // default 100 Hz until the period is known. A device that browned out
+  // while streaming comes back without a silence long enough for a
+  // reconnect, so its restarted timer only shows as a longer step back;
+  // the timer then counts from 'ticks' before this sample arrived.
+  double period = sequence_.expected() > 0.0 ? sequence_.expected() : Gx3Driver::TICK_RATE / 100.0;
+  uint64_t ticks = ticks_.unwrap(sample.timer, (uint32_t)(MAX_STEP_BACK * period));
+  if (ticks_.restarted())
+    {
+      ROS_WARN("%s: device timer restarted, stamps start over", name_.c_str());
+      restart_timer(received - ros::Duration(ticks / Gx3Driver::TICK_RATE));
+    }
+
+  SequenceTracker::Result result = track_sequence_ ? sequence_.update(ticks) : SequenceTracker::NEXT;
+  if (result == SequenceTracker::DUPLICATE)
+    ROS_WARN_THROTTLE(5.0, "%s: repeated sample at device time %u, dropped", name_.c_str(),
+                      sample.timer);
+  else
+    {
+      ros::Time stamp = stamp_sample(ticks, received);
+      if (estimate_bias_)
+        estimate_gyro_bias(stamp, sample);
+
+      // Stand-ins for the lost samples, spaced evenly between the last
+      // sample and this one
+      unsigned long missed = sequence_.missed();
+      if (result == SequenceTracker::GAP && fill_gaps_ && (int)missed <= max_fill_gap_)
+        for (unsigned long i = 1; i <= missed; i++)
+          {
+            double f = (double)i / (missed + 1);
+            Sample filled;
+            interpolate_sample(last_sample_, sample, f, filled);
+            uint64_t filled_ticks = last_ticks_ + (uint64_t)((ticks - last_ticks_) * f);
+            publish_sample(filled, stamp - ros::Duration((ticks - filled_ticks) / Gx3Driver::TICK_RATE),
+                           filled_ticks, sequence_.sequence() - missed - 1 + i, 0, true);
+          }
+
+      publish_sample(sample, stamp, ticks, sequence_.sequence(), missed, false);
+      IMU_3DM_GX3_TRACE_POINT(PUBLISH, received.toNSec());
+      last_sample_ = sample;
+      last_ticks_ = ticks;
+    }
+
+  if (freq_status_)
+    freq_status_->tick();
+
+  unsigned long allocations = imu_pool_.allocations() + mag_pool_.allocations() +
+    matrix_pool_.allocations() + stab_accel_pool_.allocations() +
+    stab_mag_pool_.allocations() + batch_pool_.allocations() + preint_pool_.allocations() +
+    info_pool_.allocations() + fused_pool_.allocations() + dec_imu_pool_.allocations() +
+    dec_mag_pool_.allocations();
+
+  boost::mutex::scoped_lock lock(stats_mutex_);
+  published_++;
+  pool_allocations_ = allocations;
+  diag_dropped_ = sequence_.dropped();
+  diag_gaps_ = sequence_.gaps();
+  diag_duplicates_ = sequence_.duplicates();
+  publish_latency_.add((ros::Time::now() - received).toSec());
+  if (!last_received_.isZero())
+    intervals_.add((received - last_received_).toSec());
+  last_received_ = received;
+}
+
+// Whatever orientation form the preset carries ends up as the same
+// quaternion; the device quaternion needs no host work at all
+bool Imu3dmGx3::sample_orientation(const Sample &sample, double *q) const
+{
+  if (preset_->quaternion >= 0)
+    {
+      // The device quaternion describes the orientation matrix M, the
+      // other paths publish its transpose
+      q[0] = sample.q[0];
+      q[1] = -sample.q[1];
+      q[2] = -sample.q[2];
+      q[3] = -sample.q[3];
+    }
+  else if (preset_->euler >= 0)
+    euler_to_quaternion(sample.euler, q);
+  else if (preset_->orientation_matrix >= 0)
+    matrix_to_quaternion(sample.M, q);
+  else
+    return false;
+  return true;
+}
+
+void Imu3dmGx3::publish_sample(const Sample &sample, const ros::Time &stamp, uint64_t ticks,
+                               uint64_t sequence, unsigned long missed, bool interpolated)
+{
+  // Only what somebody listens to is converted and published. The batch
+  // is built from the imu and magnetic messages, so it needs them too.
+  bool batch = batch_pub_ && batch_pub_.getNumSubscribers() > 0;
+  if (!batch && batch_)
+    {
+      batch_.reset();
+      batch_samples_ = 0;
+    }
+
+  // Intra-process subscribers keep a reference to what was published, so
+  // a message is only refilled once the pool sees it released
+  sensor_msgs::ImuPtr imu_msg;
+  if (imu_pub_ && (batch || imu_pub_.getNumSubscribers() > 0))
+    {
+      imu_msg = imu_pool_.acquire();
+      imu_msg->header.stamp = stamp;
+
+      if (preset_->ang_vel >= 0)
+        {
+          imu_msg->angular_velocity.x = sample.ang_vel[0] - gyro_bias_[0];
+          imu_msg->angular_velocity.y = sample.ang_vel[1] - gyro_bias_[1];
+          imu_msg->angular_velocity.z = sample.ang_vel[2] - gyro_bias_[2];
+        }
+
+      if (preset_->accel >= 0)
         {
-          ROS_ERROR("%s: failed to set mode to active", name.c_str());
-          if (serial_port->is_open())
-            serial_port->close();
-          return -1;
+          imu_msg->linear_acceleration.x = sample.accel[0] * GRAVITY_CONSTANT;
+          imu_msg->linear_acceleration.y = sample.accel[1] * GRAVITY_CONSTANT;
+          imu_msg->linear_acceleration.z = sample.accel[2] * GRAVITY_CONSTANT;
         }
+
+      double q[4];
+      if (sample_orientation(sample, q))
+        {
+          imu_msg->orientation.w = q[0];
+          imu_msg->orientation.x = q[1];
+          imu_msg->orientation.y = q[2];
+          imu_msg->orientation.z = q[3];
+        }
+
+      imu_pub_.publish(imu_msg);
+    }
+
+  sensor_msgs::MagneticFieldPtr mag_msg;
+  if (mag_pub_ && (batch || mag_pub_.getNumSubscribers() > 0))
+    {
+      mag_msg = mag_pool_.acquire();
+      mag_msg->header.stamp = stamp;
+      mag_msg->magnetic_field.x = sample.mag[0];
+      mag_msg->magnetic_field.y = sample.mag[1];
+      mag_msg->magnetic_field.z = sample.mag[2];
+
+      mag_pub_.publish(mag_msg);
     }
 
-  // Set the continous preset mode (Acceleration, Angular Rate & Magnetometer Vectors & Orientation Matrix)
-  // More detail in '3DM-GX3-25 Single Byte Data Communications Protocol' p21
-  const char preset[4] = {'\xD6','\xC6','\x6B','\xCC'};
-  boost::asio::write(*serial_port, boost::asio::buffer(preset, 4));
+  if (batch)
+    batch_sample(stamp, imu_msg, mag_msg);
+
+  if (preint_pub_)
+    preintegrate_sample(stamp, sample);
+
+  if (fused_pub_)
+    fuse_sample(stamp, sample);
 
-  boost::asio::read(*serial_port, boost::asio::buffer(reply, REPLY_LENGTH));
-  if (!validate_checksum(reply, REPLY_LENGTH))
+  if (dec_imu_pub_ || dec_mag_pub_)
+    decimate_sample(stamp, sample);
+
+  if (matrix_pub_ && matrix_pub_.getNumSubscribers() > 0)
     {
-      ROS_ERROR("%s: failed to set continuous mode preset", name.c_str());
-      if (serial_port->is_open())
-        serial_port->close();
-      return -1;
+      OrientationMatrixPtr matrix_msg = matrix_pool_.acquire();
+      matrix_msg->header.stamp = stamp;
+      for (unsigned int i = 0; i < 9; i++)
+        matrix_msg->matrix[i] = sample.M[i];
+
+      matrix_pub_.publish(matrix_msg);
     }
 
-  // Set the mode to continous output
-  mode[3] = '\x02';
-  boost::asio::write(*serial_port, boost::asio::buffer(mode, 4));
-  boost::asio::read(*serial_port, boost::asio::buffer(reply, REPLY_LENGTH));
-  if (!validate_checksum(reply, REPLY_LENGTH))
+  if (stab_accel_pub_ && stab_accel_pub_.getNumSubscribers() > 0)
     {
-      ROS_ERROR("%s: failed to set mode to continuous output", name.c_str());
-      if (serial_port->is_open())
-        serial_port->close();
-      return -1;
+      geometry_msgs::Vector3StampedPtr accel_msg = stab_accel_pool_.acquire();
+      accel_msg->header.stamp = stamp;
+      accel_msg->vector.x = sample.stab_accel[0] * GRAVITY_CONSTANT;
+      accel_msg->vector.y = sample.stab_accel[1] * GRAVITY_CONSTANT;
+      accel_msg->vector.z = sample.stab_accel[2] * GRAVITY_CONSTANT;
+
+      stab_accel_pub_.publish(accel_msg);
     }
 
-  // Set Timer
-  // Restart the time stamp at the new value
-  // New Timer value equal to 0
-  char set_timer[8] = {'\xD7','\xC1','\x29','\x01','\x00','\x00','\x00','\x00'};
-  unsigned char reply_timer[7];
-  boost::asio::write(*serial_port, boost::asio::buffer(set_timer, 8));
-  boost::asio::read(*serial_port, boost::asio::buffer(reply_timer, 7));
-  ros::Time t0 = ros::Time::now();  
+  if (stab_mag_pub_ && stab_mag_pub_.getNumSubscribers() > 0)
+    {
+      sensor_msgs::MagneticFieldPtr stab_mag_msg = stab_mag_pool_.acquire();
+      stab_mag_msg->header.stamp = stamp;
+      stab_mag_msg->magnetic_field.x = sample.stab_mag[0];
+      stab_mag_msg->magnetic_field.y = sample.stab_mag[1];
+      stab_mag_msg->magnetic_field.z = sample.stab_mag[2];
 
-  ROS_INFO("Streaming Data...");
-  unsigned char data[DATA_LENGTH];
-  sensor_msgs::Imu imu_msg;
-  sensor_msgs::MagneticField mag_msg;
-  ros::Publisher imu_pub = n.advertise<sensor_msgs::Imu>("imu", 100);
-  ros::Publisher mag_pub = n.advertise<sensor_msgs::MagneticField>("magnetic", 100);
-  while (n.ok())
-    {
-
-      boost::asio::read(*serial_port, boost::asio::buffer(data,  DATA_LENGTH));
-      if (!validate_checksum(data,  DATA_LENGTH)) {
-          ROS_ERROR("%s: checksum failed on message", name.c_str());
-          continue;
+      stab_mag_pub_.publish(stab_mag_msg);
+    }
+
+  if (info_pub_ && info_pub_.getNumSubscribers() > 0)
+    {
+      SampleInfoPtr info_msg = info_pool_.acquire();
+      info_msg->header.stamp = stamp;
+      info_msg->sequence     = sequence;
+      info_msg->device_ticks = (uint32_t)ticks;
+      info_msg->missed       = missed;
+      info_msg->dropped      = sequence_.dropped();
+      info_msg->interpolated = interpolated;
+
+      info_pub_.publish(info_msg);
+    }
+}
+
+// Rates and vectors are interpolated linearly, orientation is taken from
+// the nearer of the two samples
+void Imu3dmGx3::interpolate_sample(const Sample &a, const Sample &b, double f, Sample &out)
+{
+  out = f < 0.5 ? a : b;
+  for (unsigned int i = 0; i < 3; i++)
+    {
+      out.accel[i]      = a.accel[i] + f * (b.accel[i] - a.accel[i]);
+      out.ang_vel[i]    = a.ang_vel[i] + f * (b.ang_vel[i] - a.ang_vel[i]);
+      out.mag[i]        = a.mag[i] + f * (b.mag[i] - a.mag[i]);
+      out.stab_accel[i] = a.stab_accel[i] + f * (b.stab_accel[i] - a.stab_accel[i]);
+      out.stab_mag[i]   = a.stab_mag[i] + f * (b.stab_mag[i] - a.stab_mag[i]);
+    }
+}
+
+// Copy into an element the batch already has where possible, so its
+// strings and arrays are reused instead of allocated per sample
+template <class M>
+static void set_element(std::vector<M> &elements, size_t i, const M &msg)
+{
+  if (i < elements.size())
+    elements[i] = msg;
+  else
+    elements.push_back(msg);
+}
+
+void Imu3dmGx3::batch_sample(const ros::Time &stamp,
+                             const sensor_msgs::ImuConstPtr &imu_msg,
+                             const sensor_msgs::MagneticFieldConstPtr &mag_msg)
+{
+  if (!batch_)
+    {
+      // A recycled batch keeps the elements of its last window, they are
+      // overwritten and the surplus trimmed on publish
+      batch_ = batch_pool_.acquire();
+      batch_->header.stamp = stamp;
+    }
+
+  if (imu_msg)
+    set_element(batch_->imu, batch_samples_, *imu_msg);
+  if (mag_msg)
+    set_element(batch_->magnetic, batch_samples_, *mag_msg);
+  batch_samples_++;
+
+  bool full = batch_size_ > 0 && batch_samples_ >= batch_size_;
+  bool expired = batch_period_ > 0.0 &&
+    (stamp - batch_->header.stamp).toSec() >= batch_period_;
+
+  if (full || expired)
+    {
+      if (imu_msg)
+        batch_->imu.resize(batch_samples_);
+      if (mag_msg)
+        batch_->magnetic.resize(batch_samples_);
+      batch_pub_.publish(batch_);
+      batch_.reset();
+      batch_samples_ = 0;
+    }
+}
+
+void Imu3dmGx3::init_imu(sensor_msgs::Imu &msg)
+{
+  msg.header.frame_id = frame_id_;
+  msg.angular_velocity_covariance    = ang_vel_cov_;
+  msg.linear_acceleration_covariance = accel_cov_;
+  msg.orientation_covariance         = orientation_cov_;
+}
+
+void Imu3dmGx3::init_mag(sensor_msgs::MagneticField &msg)
+{
+  msg.header.frame_id = frame_id_;
+  msg.magnetic_field_covariance = mag_cov_;
+}
+
+// Averages over the decimation window; the orientation is that of the
+// middle sample and keeps its covariance
+void Imu3dmGx3::init_decimated_imu(sensor_msgs::Imu &msg)
+{
+  init_imu(msg);
+  scale_covariance(decimation_, msg.angular_velocity_covariance);
+  scale_covariance(decimation_, msg.linear_acceleration_covariance);
+}
+
+void Imu3dmGx3::init_decimated_mag(sensor_msgs::MagneticField &msg)
+{
+  init_mag(msg);
+  scale_covariance(decimation_, msg.magnetic_field_covariance);
+}
+
+// The fused orientation always exists, its uncertainty is unknown
+void Imu3dmGx3::init_fused(sensor_msgs::Imu &msg)
+{
+  init_imu(msg);
+  msg.orientation_covariance.assign(0.0);
+}
+
+void Imu3dmGx3::init_batch(ImuBatch &msg)
+{
+  msg.header.frame_id = frame_id_;
+  if (batch_size_ > 0)
+    {
+      // Filled with set up messages, so the first window does not
+      // allocate either
+      if (imu_pub_)
+        {
+          sensor_msgs::Imu imu;
+          init_imu(imu);
+          msg.imu.assign(batch_size_, imu);
+        }
+      if (mag_pub_)
+        {
+          sensor_msgs::MagneticField mag;
+          init_mag(mag);
+          msg.magnetic.assign(batch_size_, mag);
+        }
+    }
+}
+
+void Imu3dmGx3::estimate_gyro_bias(const ros::Time &stamp, const Sample &sample)
+{
+  double w[3] = {sample.ang_vel[0], sample.ang_vel[1], sample.ang_vel[2]};
+  bool done = bias_estimator_.update(stamp.toSec(), w);
+
+  if (!done)
+    {
+      boost::mutex::scoped_lock lock(stats_mutex_);
+      diag_bias_restarts_ = bias_estimator_.restarts();
+      return;
+    }
+
+  // Subtracted from the imu messages from now on, and the linearization
+  // point of the next preintegration window
+  const double *bias = bias_estimator_.bias();
+  double no_accel_bias[3] = {0.0, 0.0, 0.0};
+  preint_.set_bias(bias, no_accel_bias);
+  for (unsigned int i = 0; i < 3; i++)
+    gyro_bias_[i] = bias[i];
+  estimate_bias_ = false;
+
+  ROS_INFO("%s: gyro bias %.5f %.5f %.5f rad/s after %lu restarts", name_.c_str(),
+           bias[0], bias[1], bias[2], bias_estimator_.restarts());
+
+  boost::mutex::scoped_lock lock(stats_mutex_);
+  for (unsigned int i = 0; i < 3; i++)
+    diag_gyro_bias_[i] = bias[i];
+  diag_bias_restarts_ = bias_estimator_.restarts();
+}
+
+void Imu3dmGx3::handle_poll_trigger(const std_msgs::HeaderConstPtr &)
+{
+  driver_.poll();
+}
+
+void Imu3dmGx3::handle_trigger(const std_msgs::HeaderConstPtr &msg)
+{
+  boost::mutex::scoped_lock lock(trigger_mutex_);
+  // Nobody consumes triggers while the stream is down
+  if (triggers_.size() >= 100)
+    triggers_.pop_front();
+  triggers_.push_back(msg->stamp);
+}
+
+void Imu3dmGx3::preintegrate_sample(const ros::Time &stamp, const Sample &sample)
+{
+  if (preint_pub_.getNumSubscribers() == 0)
+    {
+      preint_last_ = ros::Time();
+      boost::mutex::scoped_lock lock(trigger_mutex_);
+      triggers_.clear();
+      return;
+    }
+
+  // The first sample only opens the window, a repeated one is skipped
+  if (preint_last_.isZero())
+    {
+      preint_.reset();
+      preint_start_ = stamp;
+      preint_last_ = stamp;
+      return;
+    }
+  if (stamp <= preint_last_)
+    return;
+
+  // Each sample is held over the interval since the previous one
+  double w[3], a[3];
+  for (unsigned int i = 0; i < 3; i++)
+    {
+      w[i] = sample.ang_vel[i];
+      a[i] = sample.accel[i] * GRAVITY_CONSTANT;
+    }
+
+  // A trigger inside the interval splits it. One that arrives after
+  // later samples were integrated closes the window at the last of them.
+  for (;;)
+    {
+      ros::Time trigger;
+      {
+        boost::mutex::scoped_lock lock(trigger_mutex_);
+        if (triggers_.empty() || triggers_.front() >= stamp)
+          break;
+        trigger = triggers_.front();
+        triggers_.pop_front();
       }
 
-      unsigned int k = 1;
-      float accel[3];
-      float ang_vel[3];
-      float mag[3];
-      float M[9];
-      double T;
-      for (unsigned int i = 0; i < 3; i++, k += 4)
-        accel[i] = extract_float(&(data[k]));
-      for (unsigned int i = 0; i < 3; i++, k += 4)
-        ang_vel[i] = extract_float(&(data[k]));
-      for (unsigned int i = 0; i < 3; i++, k += 4)
-        mag[i] = extract_float(&(data[k]));
-      for (unsigned int i = 0; i < 9; i++, k += 4)
-        M[i] = extract_float(&(data[k]));
-      T = extract_int(&(data[k])) / 62500.0;
-
-      imu_msg.header.stamp    = t0 + ros::Duration(T) - ros::Duration(delay);
-      imu_msg.header.frame_id = frame_id;
-      imu_msg.angular_velocity.x = ang_vel[0];
-      imu_msg.angular_velocity.y = ang_vel[1];
-      imu_msg.angular_velocity.z = ang_vel[2];
-      imu_msg.linear_acceleration.x = accel[0] * GRAVITY_CONSTANT;
-      imu_msg.linear_acceleration.y = accel[1] * GRAVITY_CONSTANT;
-      imu_msg.linear_acceleration.z = accel[2] * GRAVITY_CONSTANT;
-
-      Eigen::Matrix3d R;
-      for (unsigned int i = 0; i < 3; i++)
-        for (unsigned int j = 0; j < 3; j++)
-          R(i,j) = M[j*3+i];
-      Eigen::Quaternion<double> q(R);
-      imu_msg.orientation.w = (double)q.w();// q(0);
-      imu_msg.orientation.x = (double)q.x();// q(1);
-      imu_msg.orientation.y = (double)q.y();// q(2);
-      imu_msg.orientation.z = (double)q.z();// q(3);
-      imu_msg.orientation_covariance[0] = -1;
+      if (trigger <= preint_start_)
+        continue;
+      if (trigger > preint_last_)
+        {
+          preint_.integrate(w, a, (trigger - preint_last_).toSec());
+          preint_last_ = trigger;
+        }
+      publish_preintegration(preint_last_);
+    }
 
-      imu_pub.publish(imu_msg);
+  preint_.integrate(w, a, (stamp - preint_last_).toSec());
+  preint_last_ = stamp;
+
+  if (preint_period_ > 0.0 && (preint_last_ - preint_start_).toSec() >= preint_period_)
+    publish_preintegration(preint_last_);
+}
+
+void Imu3dmGx3::publish_preintegration(const ros::Time &end)
+{
+  if (preint_.samples() > 0)
+    {
+      ImuPreintegrationPtr msg = preint_pool_.acquire();
+      msg->header.stamp = end;
+      msg->start   = preint_start_;
+      msg->samples = preint_.samples();
 
-      mag_msg.header.stamp    = t0 + ros::Duration(T) - ros::Duration(delay);
-      mag_msg.header.frame_id = frame_id;
-      mag_msg.magnetic_field.x = mag[0];
-      mag_msg.magnetic_field.y = mag[1];
-      mag_msg.magnetic_field.z = mag[2];
+      const double *bg = preint_.gyro_bias();
+      const double *ba = preint_.accel_bias();
+      msg->gyro_bias.x = bg[0];
+      msg->gyro_bias.y = bg[1];
+      msg->gyro_bias.z = bg[2];
+      msg->accel_bias.x = ba[0];
+      msg->accel_bias.y = ba[1];
+      msg->accel_bias.z = ba[2];
 
-      mag_pub.publish(mag_msg);
+      double q[4];
+      preint_.delta_quaternion(q);
+      msg->delta_rotation.w = q[0];
+      msg->delta_rotation.x = q[1];
+      msg->delta_rotation.y = q[2];
+      msg->delta_rotation.z = q[3];
+      const double *dv = preint_.delta_velocity();
+      const double *dp = preint_.delta_position();
+      msg->delta_velocity.x = dv[0];
+      msg->delta_velocity.y = dv[1];
+      msg->delta_velocity.z = dv[2];
+      msg->delta_position.x = dp[0];
+      msg->delta_position.y = dp[1];
+      msg->delta_position.z = dp[2];
 
+      for (unsigned int i = 0; i < 9; i++)
+        {
+          msg->d_rotation_d_gyro_bias[i]  = preint_.d_rotation_d_gyro_bias()[i];
+          msg->d_velocity_d_gyro_bias[i]  = preint_.d_velocity_d_gyro_bias()[i];
+          msg->d_velocity_d_accel_bias[i] = preint_.d_velocity_d_accel_bias()[i];
+          msg->d_position_d_gyro_bias[i]  = preint_.d_position_d_gyro_bias()[i];
+          msg->d_position_d_accel_bias[i] = preint_.d_position_d_accel_bias()[i];
+        }
+      for (unsigned int i = 0; i < 81; i++)
+        msg->covariance[i] = preint_.covariance()[i];
+
+      preint_pub_.publish(msg);
+    }
+
+  preint_.reset();
+  preint_start_ = end;
+}
+
+void Imu3dmGx3::fuse_sample(const ros::Time &stamp, const Sample &sample)
+{
+  if (stamp <= fusion_last_)
+    return;
+
+  double w[3], a[3], m[3];
+  for (unsigned int i = 0; i < 3; i++)
+    {
+      w[i] = sample.ang_vel[i] - gyro_bias_[i];
+      a[i] = sample.accel[i] * GRAVITY_CONSTANT;
+      m[i] = sample.mag[i];
+    }
+
+  // A reconnect only loses the interval, a long silence the orientation
+  double dt = fusion_last_.isZero() ? 0.0 : (stamp - fusion_last_).toSec();
+  if (dt > MAX_FUSION_STEP)
+    fusion_.reset();
+  fusion_.update(w, a, fusion_mag_ ? m : NULL, dt);
+  fusion_last_ = stamp;
+
+  if (!fusion_.initialized() || fused_pub_.getNumSubscribers() == 0)
+    return;
+
+  sensor_msgs::ImuPtr msg = fused_pool_.acquire();
+  msg->header.stamp = stamp;
+  const double *q = fusion_.quaternion();
+  msg->orientation.w = q[0];
+  msg->orientation.x = q[1];
+  msg->orientation.y = q[2];
+  msg->orientation.z = q[3];
+  msg->angular_velocity.x = w[0];
+  msg->angular_velocity.y = w[1];
+  msg->angular_velocity.z = w[2];
+  msg->linear_acceleration.x = a[0];
+  msg->linear_acceleration.y = a[1];
+  msg->linear_acceleration.z = a[2];
+
+  fused_pub_.publish(msg);
+}
+
+// Boxcar averages over decimation_ samples: the window acts as the
+// anti-aliasing filter, with its first zero at the decimated rate
+void Imu3dmGx3::decimate_sample(const ros::Time &stamp, const Sample &sample)
+{
+  bool imu = dec_imu_pub_ && dec_imu_pub_.getNumSubscribers() > 0;
+  bool mag = dec_mag_pub_ && dec_mag_pub_.getNumSubscribers() > 0;
+  if (!imu && !mag)
+    {
+      dec_samples_ = 0;
+      return;
+    }
+
+  if (dec_samples_ == 0)
+    {
+      dec_start_ = stamp;
+      dec_offset_ = 0.0;
+      for (unsigned int i = 0; i < 3; i++)
+        dec_ang_vel_[i] = dec_accel_[i] = dec_mag_[i] = 0.0;
+    }
+
+  dec_offset_ += (stamp - dec_start_).toSec();
+  for (unsigned int i = 0; i < 3; i++)
+    {
+      dec_ang_vel_[i] += sample.ang_vel[i] - gyro_bias_[i];
+      dec_accel_[i] += sample.accel[i];
+      dec_mag_[i] += sample.mag[i];
     }
 
-  // Stop continous and close device
-  boost::asio::write(*serial_port, boost::asio::buffer(stop, STOP_CMD_LENGTH));
-  ROS_WARN("Wait 0.1s"); 
-  ros::Duration(0.1).sleep();
-  serial_port->close(); 
+  // Orientations are not averaged; the one of the middle sample belongs
+  // to the stamp of the average
+  if (dec_samples_ == decimation_ / 2)
+    dec_has_q_ = sample_orientation(sample, dec_q_);
+
+  if (++dec_samples_ < decimation_)
+    return;
+  dec_samples_ = 0;
+
+  ros::Time center = dec_start_ + ros::Duration(dec_offset_ / decimation_);
+  double scale = 1.0 / decimation_;
+
+  if (imu)
+    {
+      sensor_msgs::ImuPtr msg = dec_imu_pool_.acquire();
+      msg->header.stamp = center;
+      if (preset_->ang_vel >= 0)
+        {
+          msg->angular_velocity.x = dec_ang_vel_[0] * scale;
+          msg->angular_velocity.y = dec_ang_vel_[1] * scale;
+          msg->angular_velocity.z = dec_ang_vel_[2] * scale;
+        }
+      if (preset_->accel >= 0)
+        {
+          msg->linear_acceleration.x = dec_accel_[0] * scale * GRAVITY_CONSTANT;
+          msg->linear_acceleration.y = dec_accel_[1] * scale * GRAVITY_CONSTANT;
+          msg->linear_acceleration.z = dec_accel_[2] * scale * GRAVITY_CONSTANT;
+        }
+      if (dec_has_q_)
+        {
+          msg->orientation.w = dec_q_[0];
+          msg->orientation.x = dec_q_[1];
+          msg->orientation.y = dec_q_[2];
+          msg->orientation.z = dec_q_[3];
+        }
+      dec_imu_pub_.publish(msg);
+    }
 
-  return 0;
+  if (mag)
+    {
+      sensor_msgs::MagneticFieldPtr msg = dec_mag_pool_.acquire();
+      msg->header.stamp = center;
+      msg->magnetic_field.x = dec_mag_[0] * scale;
+      msg->magnetic_field.y = dec_mag_[1] * scale;
+      msg->magnetic_field.z = dec_mag_[2] * scale;
+      dec_mag_pub_.publish(msg);
+    }
+}
 
 }
@@ -0,0 +1,870 @@
+// Pseudo-terminal emulator of the Microstrain 3DM-GX3-25
+// N. Michael
+//
+// Creates a pseudo-terminal that answers the handshake of the driver and
+// streams or polls frames of any preset, at the device rates or far above
+// them, with bytes dropped and corrupted on request. Meant for exercising
+// the parser, reconnects and multi-device setups without hardware: point
+// 'port' at the printed device (or the --link) and run one emulator per
+// device.
+
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pty.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#include <imu_3dm_gx3/decode.h>
+#include <imu_3dm_gx3/presets.h>
+
+#define BASE_RATE 1000
+#define TICK_RATE 62500.0
+#define SAMPLING_LENGTH 16
+#define DEFAULT_BAUD 115200
+// Frames generated per loop at most when the stream is behind
+#define MAX_BURST 256
+// A stream further behind than this (s) gives up on the missed frames
+#define MAX_LAG 1.0
+// Bytes the link can send back to back (s at the link rate)
+#define LINK_BURST 0.005
+
+namespace imu_3dm_gx3
+{
+
+enum Mode
+{
+  MODE_ACTIVE = 1,
+  MODE_CONTINUOUS = 2,
+  MODE_IDLE = 3
+};
+
+// The default sampling settings: decimation 10 (100 Hz), orientation and
+// coning and sculling on, filter windows 15 and 17
+static const unsigned char default_sampling[SAMPLING_LENGTH] = {
+  0x00, 0x0A, 0x00, 0x03, 0x0F, 0x11, 0x00, 0x0A, 0x00, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+// What the emulated gyros read at rest (rad/s), until a capture removes it
+static const float gyro_bias[3] = {0.004f, -0.003f, 0.002f};
+
+// Earth field in the world frame (gauss)
+static const float field[3] = {0.22f, 0.0f, 0.42f};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int)
+{
+  stop_requested = 1;
+}
+
+static double monotonic_seconds()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+struct BaudRate
+{
+  int baud;
+  speed_t speed;
+};
+
+static const BaudRate baud_rates[] = {
+  {9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600},
+  {115200, B115200}, {230400, B230400}, {460800, B460800}, {921600, B921600}
+};
+
+static const size_t num_baud_rates = sizeof(baud_rates) / sizeof(baud_rates[0]);
+
+static bool valid_baud(int baud)
+{
+  for (size_t i = 0; i < num_baud_rates; i++)
+    if (baud_rates[i].baud == baud)
+      return true;
+  return false;
+}
+
+// The rate the host set on the terminal; the master shares the termios
+// of the slave. 0 for a rate the device does not support.
+static int host_baud(int fd)
+{
+  termios tio;
+  if (tcgetattr(fd, &tio) < 0)
+    return 0;
+  speed_t speed = cfgetospeed(&tio);
+  for (size_t i = 0; i < num_baud_rates; i++)
+    if (baud_rates[i].speed == speed)
+      return baud_rates[i].baud;
+  return 0;
+}
+
+static void encode_float(float v, unsigned char *dst)
+{
+  uint32_t w;
+  memcpy(&w, &v, sizeof(w));
+  encode_be32(w, dst);
+}
+
+// Append the checksum to a reply of 'length' bytes before it
+static void finish_reply(unsigned char *reply, size_t length)
+{
+  uint16_t checksum = 0;
+  for (size_t i = 0; i < length; i++)
+    checksum += reply[i];
+  encode_be16(checksum, reply + length);
+}
+
+struct Options
+{
+  std::string link;
+  unsigned char preset;
+  double rate;
+  bool streaming;
+  int baud;
+  bool limit;
+  double drop;
+  double corrupt;
+  double lose;
+  double reset_every;
+  double duration;
+  double yaw_rate;
+  unsigned int seed;
+  bool verbose;
+
+  Options();
+};
+
+Options::Options() :
+  preset(0xCC),
+  rate(0.0),
+  streaming(false),
+  baud(DEFAULT_BAUD),
+  limit(false),
+  drop(0.0),
+  corrupt(0.0),
+  lose(0.0),
+  reset_every(0.0),
+  duration(0.0),
+  yaw_rate(0.1),
+  seed(1),
+  verbose(false)
+{
+}
+
+struct Stats
+{
+  unsigned long frames;
+  unsigned long polls;
+  unsigned long commands;
+  unsigned long bytes;
+  unsigned long dropped;
+  unsigned long corrupted;
+  unsigned long lost;
+  unsigned long limited;
+  unsigned long overrun;
+  unsigned long resets;
+};
+
+// What the device keeps across commands; a copy stands in for the EEPROM
+// a power cycle restores it from
+struct DeviceState
+{
+  int mode;
+  unsigned char preset;
+  unsigned char sampling[SAMPLING_LENGTH];
+  int baud;
+  unsigned char port_config;
+};
+
+class Emulator
+{
+public:
+  Emulator(const Options &options);
+  ~Emulator();
+
+  bool open();
+  void run();
+  void close();
+
+  const Stats &stats() const { return stats_; }
+
+private:
+  double rate() const;
+  uint32_t ticks(double t) const;
+  double uniform();
+
+  void power_up(double now);
+  void set_mode(int mode, double now);
+  void make_sample(double t, Sample &sample) const;
+  void send_frame(const Preset &preset, double t);
+  void send(const unsigned char *data, size_t length, bool faults);
+  void flush();
+  void receive(double now);
+  bool handle_command(double now);
+  void log(const char *format, ...);
+
+  Options options_;
+  int master_;
+  int slave_;
+  std::string path_;
+
+  DeviceState state_;
+  DeviceState eeprom_;
+  double start_;
+  double timer_origin_;
+  uint32_t timer_value_;
+  double next_frame_;
+  double next_reset_;
+  double bias_due_;
+  bool bias_pending_;
+  float captured_bias_[3];
+
+  double budget_;
+  double budget_time_;
+  uint32_t rng_;
+
+  std::vector<unsigned char> in_;
+  std::vector<unsigned char> out_;
+  Stats stats_;
+};
+
+Emulator::Emulator(const Options &options) :
+  options_(options),
+  master_(-1),
+  slave_(-1),
+  start_(0.0),
+  timer_origin_(0.0),
+  timer_value_(0),
+  next_frame_(0.0),
+  next_reset_(0.0),
+  bias_due_(0.0),
+  bias_pending_(false),
+  budget_(0.0),
+  budget_time_(0.0),
+  rng_(options.seed ? options.seed : 1)
+{
+  memset(&stats_, 0, sizeof(stats_));
+  eeprom_.mode = options.streaming ? MODE_CONTINUOUS : MODE_ACTIVE;
+  eeprom_.preset = options.preset;
+  memcpy(eeprom_.sampling, default_sampling, SAMPLING_LENGTH);
+  eeprom_.baud = options.baud;
+  eeprom_.port_config = 0x13;
+  state_ = eeprom_;
+  memset(captured_bias_, 0, sizeof(captured_bias_));
+}
+
+Emulator::~Emulator()
+{
+  close();
+}
+
+bool Emulator::open()
+{
+  char name[256];
+  if (openpty(&master_, &slave_, name, NULL, NULL) < 0)
+    {
+      perror("openpty");
+      return false;
+    }
+  path_ = name;
+
+  // The slave stays open here as well, so the master does not hang up
+  // while no host has the port open
+  termios tio;
+  tcgetattr(slave_, &tio);
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, B115200);
+  cfsetospeed(&tio, B115200);
+  tcsetattr(slave_, TCSANOW, &tio);
+  fcntl(master_, F_SETFL, fcntl(master_, F_GETFL) | O_NONBLOCK);
+
+  if (!options_.link.empty())
+    {
+      struct stat st;
+      if (lstat(options_.link.c_str(), &st) == 0)
+        {
+          if (!S_ISLNK(st.st_mode))
+            {
+              fprintf(stderr, "%s exists and is not a symlink\n", options_.link.c_str());
+              return false;
+            }
+          unlink(options_.link.c_str());
+        }
+      if (symlink(path_.c_str(), options_.link.c_str()) < 0)
+        {
+          perror(options_.link.c_str());
+          return false;
+        }
+    }
+
+  printf("%s\n", path_.c_str());
+  fflush(stdout);
+  return true;
+}
+
+void Emulator::close()
+{
+  if (master_ < 0)
+    return;
+  if (!options_.link.empty())
+    unlink(options_.link.c_str());
+  ::close(master_);
+  ::close(slave_);
+  master_ = slave_ = -1;
+}
+
+double Emulator::rate() const
+{
+  if (options_.rate > 0.0)
+    return options_.rate;
+  uint16_t decimation = decode_be16(state_.sampling);
+  return (double)BASE_RATE / (decimation ? decimation : 1);
+}
+
+uint32_t Emulator::ticks(double t) const
+{
+  // Frames due right before a timer reset count back from it
+  return timer_value_ + (uint32_t)(int64_t)floor((t - timer_origin_) * TICK_RATE);
+}
+
+// xorshift32, enough for fault injection and reproducible by seed
+double Emulator::uniform()
+{
+  rng_ ^= rng_ << 13;
+  rng_ ^= rng_ >> 17;
+  rng_ ^= rng_ << 5;
+  return rng_ * (1.0 / 4294967296.0);
+}
+
+void Emulator::power_up(double now)
+{
+  state_ = eeprom_;
+  timer_origin_ = now;
+  timer_value_ = 0;
+  bias_pending_ = false;
+  memset(captured_bias_, 0, sizeof(captured_bias_));
+  in_.clear();
+  out_.clear();
+  next_frame_ = now + 1.0 / rate();
+}
+
+void Emulator::set_mode(int mode, double now)
+{
+  if (mode == MODE_CONTINUOUS && state_.mode != MODE_CONTINUOUS)
+    next_frame_ = now + 1.0 / rate();
+  state_.mode = mode;
+}
+
+// The device turns about its z axis at the yaw rate, level and at rest
+// otherwise; M = R_z(yaw)^T as in orientation.h
+void Emulator::make_sample(double t, Sample &sample) const
+{
+  double yaw = options_.yaw_rate * (t - start_);
+  float c = (float)cos(yaw), s = (float)sin(yaw);
+  const float M[9] = {c, s, 0.0f, -s, c, 0.0f, 0.0f, 0.0f, 1.0f};
+
+  memcpy(sample.M, M, sizeof(M));
+  for (int i = 0; i < 3; i++)
+    {
+      sample.accel[i] = i == 2 ? -1.0f : 0.0f;
+      sample.ang_vel[i] = (i == 2 ? (float)options_.yaw_rate : 0.0f) + gyro_bias[i] - captured_bias_[i];
+      sample.mag[i] = M[3*i] * field[0] + M[3*i+1] * field[1] + M[3*i+2] * field[2];
+      sample.stab_accel[i] = sample.accel[i];
+      sample.stab_mag[i] = sample.mag[i];
+      sample.euler[i] = i == 2 ? (float)atan2(sin(yaw), cos(yaw)) : 0.0f;
+    }
+  sample.q[0] = (float)cos(0.5 * yaw);
+  sample.q[1] = 0.0f;
+  sample.q[2] = 0.0f;
+  sample.q[3] = (float)sin(0.5 * yaw);
+  sample.timer = ticks(t);
+}
+
+void Emulator::send_frame(const Preset &preset, double t)
+{
+  if (options_.lose > 0.0 && uniform() < options_.lose)
+    {
+      stats_.lost++;
+      return;
+    }
+
+  // A frame the link has no room for never leaves the device
+  if (options_.limit)
+    {
+      if (budget_ < preset.length)
+        {
+          stats_.limited++;
+          return;
+        }
+      budget_ -= preset.length;
+    }
+
+  Sample sample;
+  unsigned char frame[MAX_FRAME_LENGTH];
+  make_sample(t, sample);
+  encode_frame(preset, sample, frame);
+  send(frame, preset.length, true);
+  stats_.frames++;
+}
+
+void Emulator::send(const unsigned char *data, size_t length, bool faults)
+{
+  if (!faults || (options_.drop <= 0.0 && options_.corrupt <= 0.0))
+    {
+      out_.insert(out_.end(), data, data + length);
+      return;
+    }
+
+  for (size_t i = 0; i < length; i++)
+    {
+      if (options_.drop > 0.0 && uniform() < options_.drop)
+        {
+          stats_.dropped++;
+          continue;
+        }
+      unsigned char byte = data[i];
+      if (options_.corrupt > 0.0 && uniform() < options_.corrupt)
+        {
+          byte ^= (unsigned char)(1 << (rng_ % 8));
+          stats_.corrupted++;
+        }
+      out_.push_back(byte);
+    }
+}
+
+// Whatever the terminal has no room for is lost, as with a UART nobody
+// reads from. At the wrong rate the host only sees garbage.
+void Emulator::flush()
+{
+  if (out_.empty())
+    return;
+
+  if (host_baud(master_) != state_.baud)
+    for (size_t i = 0; i < out_.size(); i++)
+      out_[i] ^= 0x55;
+
+  ssize_t written = ::write(master_, &out_[0], out_.size());
+  if (written < 0)
+    written = 0;
+  stats_.bytes += written;
+  stats_.overrun += out_.size() - written;
+  out_.clear();
+}
+
+void Emulator::receive(double now)
+{
+  unsigned char buffer[256];
+  ssize_t n;
+  while ((n = ::read(master_, buffer, sizeof(buffer))) > 0)
+    {
+      // Sent at another rate than the device listens at, nothing arrives
+      // intact
+      if (host_baud(master_) != state_.baud)
+        {
+          log("%ld bytes at the wrong baud rate ignored", (long)n);
+          continue;
+        }
+      in_.insert(in_.end(), buffer, buffer + n);
+    }
+
+  while (!in_.empty() && handle_command(now))
+    ;
+}
+
+// Handle the command at the start of the input; false while it is still
+// incomplete
+bool Emulator::handle_command(double now)
+{
+  const unsigned char *cmd = &in_[0];
+  size_t length = 1;
+  unsigned char reply[32];
+  size_t reply_length = 0;
+
+  switch (cmd[0])
+    {
+    case 0xFA:  // stop continuous mode
+      length = 3;
+      if (in_.size() < length)
+        return false;
+      if (cmd[1] == 0x75 && cmd[2] == 0xB4)
+        {
+          log("stop");
+          if (state_.mode == MODE_CONTINUOUS)
+            state_.mode = MODE_ACTIVE;
+        }
+      else
+        length = 1;
+      break;
+
+    case 0xD4:  // mode
+      length = 4;
+      if (in_.size() < length)
+        return false;
+      if (cmd[1] == 0xA3 && cmd[2] == 0x47)
+        {
+          if (cmd[3] >= MODE_ACTIVE && cmd[3] <= MODE_IDLE)
+            set_mode(cmd[3], now);
+          log("mode %d", state_.mode);
+          reply[0] = 0xD4;
+          reply[1] = (unsigned char)state_.mode;
+          reply_length = 2;
+        }
+      else
+        length = 1;
+      break;
+
+    case 0xD6:  // continuous preset
+      length = 4;
+      if (in_.size() < length)
+        return false;
+      if (cmd[1] == 0xC6 && cmd[2] == 0x6B)
+        {
+          if (find_preset(cmd[3]))
+            state_.preset = cmd[3];
+          log("preset 0x%02X", state_.preset);
+          reply[0] = 0xD6;
+          reply[1] = state_.preset;
+          reply_length = 2;
+        }
+      else
+        length = 1;
+      break;
+
+    case 0xD7:  // timer
+      length = 8;
+      if (in_.size() < length)
+        return false;
+      if (cmd[1] == 0xC1 && cmd[2] == 0x29)
+        {
+          if (cmd[3] == 0x01)
+            {
+              timer_origin_ = now;
+              timer_value_ = decode_be32(cmd + 4);
+              log("timer set to %u", timer_value_);
+            }
+          reply[0] = 0xD7;
+          encode_be32(ticks(now), reply + 1);
+          reply_length = 5;
+        }
+      else
+        length = 1;
+      break;
+
+    case 0xDB:  // sampling settings
+      length = 4 + SAMPLING_LENGTH;
+      if (in_.size() < length)
+        return false;
+      if (cmd[1] == 0xA8 && cmd[2] == 0xB9)
+        {
+          if (cmd[3] >= 0x01 && cmd[3] <= 0x03 && decode_be16(cmd + 4) > 0)
+            {
+              memcpy(state_.sampling, cmd + 4, SAMPLING_LENGTH);
+              if (cmd[3] == 0x02)
+                memcpy(eeprom_.sampling, cmd + 4, SAMPLING_LENGTH);
+              log("sampling %.1f Hz, flags 0x%04X, windows %d/%d%s", rate(),
+                  decode_be16(cmd + 6), cmd[8], cmd[9], cmd[3] == 0x02 ? ", stored" : "");
+            }
+          if (cmd[3] != 0x03)
+            {
+              reply[0] = 0xDB;
+              memcpy(reply + 1, state_.sampling, SAMPLING_LENGTH);
+              reply_length = 1 + SAMPLING_LENGTH;
+            }
+        }
+      else
+        length = 1;
+      break;
+
+    case 0xD9:  // communication settings
+      length = 11;
+      if (in_.size() < length)
+        return false;
+      if (cmd[1] == 0xC3 && cmd[2] == 0x55)
+        {
+          int baud = (int)decode_be32(cmd + 5);
+          bool change = (cmd[4] == 0x01 || cmd[4] == 0x02) && valid_baud(baud);
+          reply[0] = 0xD9;
+          encode_be32(change ? baud : state_.baud, reply + 1);
+          reply[5] = change ? cmd[9] : state_.port_config;
+          reply[6] = 0;
+          reply[7] = 0;
+          reply_length = 8;
+          if (change)
+            {
+              // The reply still goes out at the old rate
+              finish_reply(reply, reply_length);
+              send(reply, reply_length + 2, false);
+              flush();
+              reply_length = 0;
+              state_.baud = baud;
+              state_.port_config = cmd[9];
+              if (cmd[4] == 0x02)
+                {
+                  eeprom_.baud = baud;
+                  eeprom_.port_config = cmd[9];
+                }
+              log("baud %d%s", baud, cmd[4] == 0x02 ? ", stored" : "");
+            }
+        }
+      else
+        length = 1;
+      break;
+
+    case 0xCD:  // capture gyro bias
+      length = 5;
+      if (in_.size() < length)
+        return false;
+      if (cmd[1] == 0xC1 && cmd[2] == 0x29)
+        {
+          bias_due_ = now + 1e-3 * decode_be16(cmd + 3);
+          bias_pending_ = true;
+          log("capturing gyro bias for %d ms", decode_be16(cmd + 3));
+        }
+      else
+        length = 1;
+      break;
+
+    default:
+      // In active mode a preset command byte polls one frame
+      {
+        const Preset *preset = find_preset(cmd[0]);
+        if (preset && state_.mode == MODE_ACTIVE)
+          {
+            send_frame(*preset, now);
+            stats_.polls++;
+          }
+      }
+      break;
+    }
+
+  if (length > 1)
+    stats_.commands++;
+  if (reply_length > 0)
+    {
+      finish_reply(reply, reply_length);
+      send(reply, reply_length + 2, false);
+    }
+  in_.erase(in_.begin(), in_.begin() + length);
+  return true;
+}
+
+void Emulator::log(const char *format, ...)
+{
+  if (!options_.verbose)
+    return;
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "%.3f ", monotonic_seconds() - start_);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+void Emulator::run()
+{
+  start_ = monotonic_seconds();
+  budget_time_ = start_;
+  power_up(start_);
+  if (options_.reset_every > 0.0)
+    next_reset_ = start_ + options_.reset_every;
+  double end = options_.duration > 0.0 ? start_ + options_.duration : 0.0;
+
+  while (!stop_requested)
+    {
+      double now = monotonic_seconds();
+      if (end > 0.0 && now >= end)
+        break;
+
+      if (options_.reset_every > 0.0 && now >= next_reset_)
+        {
+          log("power cycle");
+          power_up(now);
+          next_reset_ = now + options_.reset_every;
+          stats_.resets++;
+        }
+
+      if (options_.limit)
+        {
+          double bytes_per_second = state_.baud / 10.0;
+          budget_ = std::min(budget_ + (now - budget_time_) * bytes_per_second,
+                             LINK_BURST * bytes_per_second + MAX_FRAME_LENGTH);
+          budget_time_ = now;
+        }
+
+      if (bias_pending_ && now >= bias_due_)
+        {
+          memcpy(captured_bias_, gyro_bias, sizeof(captured_bias_));
+          unsigned char reply[19];
+          reply[0] = 0xCD;
+          for (int i = 0; i < 3; i++)
+            encode_float(gyro_bias[i], reply + 1 + 4 * i);
+          encode_be32(ticks(now), reply + 13);
+          finish_reply(reply, 17);
+          send(reply, sizeof(reply), false);
+          bias_pending_ = false;
+          log("gyro bias captured");
+        }
+
+      if (state_.mode == MODE_CONTINUOUS)
+        {
+          if (now - next_frame_ > MAX_LAG)
+            next_frame_ = now;
+          const Preset *preset = find_preset(state_.preset);
+          double period = 1.0 / rate();
+          for (int i = 0; i < MAX_BURST && next_frame_ <= now; i++)
+            {
+              send_frame(*preset, next_frame_);
+              next_frame_ += period;
+            }
+        }
+      flush();
+
+      // Sleep until the next frame or event, or until the host writes
+      double wake = end > 0.0 ? end : now + 1.0;
+      if (state_.mode == MODE_CONTINUOUS)
+        wake = std::min(wake, next_frame_);
+      if (bias_pending_)
+        wake = std::min(wake, bias_due_);
+      if (options_.reset_every > 0.0)
+        wake = std::min(wake, next_reset_);
+      double timeout = std::max(0.0, wake - monotonic_seconds());
+
+      pollfd pfd;
+      pfd.fd = master_;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      timespec ts;
+      ts.tv_sec = (time_t)timeout;
+      ts.tv_nsec = (long)((timeout - ts.tv_sec) * 1e9);
+      if (ppoll(&pfd, 1, &ts, NULL) > 0 && (pfd.revents & POLLIN))
+        {
+          receive(monotonic_seconds());
+          flush();
+        }
+    }
+}
+
+}
+
+static void usage(FILE *out)
+{
+  fprintf(out,
+          "usage: imu_3dm_gx3_emulator [options]\n"
+          "Emulates a 3DM-GX3-25 on a pseudo-terminal, whose path is printed.\n"
+          "  -l, --link PATH      also make PATH a symlink to the terminal\n"
+          "  -p, --preset CMD     preset streamed until the host sets one (0xCC),\n"
+          "                       as command byte or name\n"
+          "  -r, --rate HZ        stream at this rate whatever decimation is set,\n"
+          "                       also beyond 1000 Hz\n"
+          "  -s, --streaming      power up streaming, as a device left in continuous mode\n"
+          "  -b, --baud N         baud rate at power-up (115200)\n"
+          "      --limit          drop the frames the baud rate has no room for\n"
+          "      --drop P         probability of dropping each byte of a frame\n"
+          "      --corrupt P      probability of flipping a bit of each byte of a frame\n"
+          "      --lose P         probability of losing each frame\n"
+          "      --reset-every S  power cycle every S seconds\n"
+          "  -d, --duration S     exit after S seconds\n"
+          "      --yaw-rate W     turn rate about z (rad/s, 0.1)\n"
+          "      --seed N         seed of the fault injection\n"
+          "  -v, --verbose        log commands to stderr\n");
+}
+
+int main(int argc, char **argv)
+{
+  using imu_3dm_gx3::Options;
+
+  enum { OPT_LIMIT = 256, OPT_DROP, OPT_CORRUPT, OPT_LOSE, OPT_RESET_EVERY, OPT_YAW_RATE, OPT_SEED };
+  static const option long_options[] = {
+    {"link", required_argument, 0, 'l'},
+    {"preset", required_argument, 0, 'p'},
+    {"rate", required_argument, 0, 'r'},
+    {"streaming", no_argument, 0, 's'},
+    {"baud", required_argument, 0, 'b'},
+    {"limit", no_argument, 0, OPT_LIMIT},
+    {"drop", required_argument, 0, OPT_DROP},
+    {"corrupt", required_argument, 0, OPT_CORRUPT},
+    {"lose", required_argument, 0, OPT_LOSE},
+    {"reset-every", required_argument, 0, OPT_RESET_EVERY},
+    {"duration", required_argument, 0, 'd'},
+    {"yaw-rate", required_argument, 0, OPT_YAW_RATE},
+    {"seed", required_argument, 0, OPT_SEED},
+    {"verbose", no_argument, 0, 'v'},
+    {"help", no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  Options options;
+  int c;
+  while ((c = getopt_long(argc, argv, "l:p:r:sb:d:vh", long_options, NULL)) != -1)
+    {
+      switch (c)
+        {
+        case 'l': options.link = optarg; break;
+        case 'p':
+          {
+            const imu_3dm_gx3::Preset *preset = imu_3dm_gx3::find_preset(std::string(optarg));
+            if (!preset)
+              preset = imu_3dm_gx3::find_preset((unsigned char)strtol(optarg, NULL, 0));
+            if (!preset)
+              {
+                fprintf(stderr, "unknown preset %s\n", optarg);
+                return 1;
+              }
+            options.preset = preset->command;
+          }
+          break;
+        case 'r': options.rate = atof(optarg); break;
+        case 's': options.streaming = true; break;
+        case 'b':
+          options.baud = atoi(optarg);
+          if (!imu_3dm_gx3::valid_baud(options.baud))
+            {
+              fprintf(stderr, "unsupported baud rate %s\n", optarg);
+              return 1;
+            }
+          break;
+        case OPT_LIMIT: options.limit = true; break;
+        case OPT_DROP: options.drop = atof(optarg); break;
+        case OPT_CORRUPT: options.corrupt = atof(optarg); break;
+        case OPT_LOSE: options.lose = atof(optarg); break;
+        case OPT_RESET_EVERY: options.reset_every = atof(optarg); break;
+        case 'd': options.duration = atof(optarg); break;
+        case OPT_YAW_RATE: options.yaw_rate = atof(optarg); break;
+        case OPT_SEED: options.seed = (unsigned int)strtoul(optarg, NULL, 0); break;
+        case 'v': options.verbose = true; break;
+        case 'h': usage(stdout); return 0;
+        default: usage(stderr); return 1;
+        }
+    }
+
+  imu_3dm_gx3::Emulator emulator(options);
+  if (!emulator.open())
+    return 1;
+
+  signal(SIGINT, imu_3dm_gx3::on_signal);
+  signal(SIGTERM, imu_3dm_gx3::on_signal);
+  emulator.run();
+  emulator.close();
+
+  const imu_3dm_gx3::Stats &stats = emulator.stats();
+  fprintf(stderr,
+          "%lu frames (%lu polled), %lu bytes, %lu commands\n"
+          "%lu bytes dropped, %lu corrupted, %lu frames lost, %lu over the link rate, "
+          "%lu bytes overrun, %lu power cycles\n",
+          stats.frames, stats.polls, stats.bytes, stats.commands,
+          stats.dropped, stats.corrupted, stats.lost, stats.limited,
+          stats.overrun, stats.resets);
+  return 0;
+}
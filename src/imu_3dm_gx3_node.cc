@@ -0,0 +1,135 @@
+// Interface to the Microstrain 3DM-GX3-25
+// N. Michael
+
+#include <csignal>
+#include <string>
+#include <vector>
+#include <ros/ros.h>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <imu_3dm_gx3/imu_3dm_gx3.h>
+
+std::vector<imu_3dm_gx3::Imu3dmGx3*> imus;
+boost::asio::signal_set *signals = 0;
+boost::atomic<int> running(0);
+
+// Only installed for the handshake; once streaming, signals are delivered
+// through the io_service
+void signal_handler(int signal){
+  if(ros::isInitialized() && ros::isStarted() && ros::ok() && !ros::isShuttingDown()){
+    for (size_t i = 0; i < imus.size(); i++)
+      imus[i]->close();
+    ROS_WARN("Stop imu streaming!");
+    ROS_INFO("Serial port closed!");
+    ros::shutdown();
+  }
+}
+
+void stop_all()
+{
+  for (size_t i = 0; i < imus.size(); i++)
+    imus[i]->request_stop();
+}
+
+void cancel_signals()
+{
+  boost::system::error_code ignored;
+  signals->cancel(ignored);
+}
+
+// Once the last device has stopped nothing but the signal wait is left,
+// and io_service.run() only returns when that is gone too
+void imu_stopped(boost::asio::io_service *io_service)
+{
+  if (--running == 0)
+    io_service->post(&cancel_signals);
+}
+
+void run_io(boost::asio::io_service *io_service, const ros::NodeHandle *n)
+{
+  imu_3dm_gx3::configure_io_thread(*n, ros::this_node::getName());
+  io_service->run();
+}
+
+void close_all()
+{
+  for (size_t i = 0; i < imus.size(); i++)
+    {
+      imus[i]->close();
+      delete imus[i];
+    }
+  imus.clear();
+}
+
+int main(int argc, char** argv)
+{
+
+  signal(SIGINT,signal_handler);
+  ros::init(argc, argv, "imu_3dm_gx3", ros::init_options::NoSigintHandler);
+  ros::NodeHandle n("~");
+
+  // One device configured by the private parameters, or several, each
+  // configured and published under ~<device>/
+  std::vector<std::string> devices;
+  n.getParam("devices", devices);
+
+  int threads;
+  bool align_timers;
+  n.param("threads", threads, 1);
+  n.param("align_timers", align_timers, false);
+
+  boost::asio::io_service io_service;
+  if (devices.empty())
+    imus.push_back(new imu_3dm_gx3::Imu3dmGx3(io_service, n, ros::this_node::getName()));
+  else
+    for (size_t i = 0; i < devices.size(); i++)
+      {
+        ros::NodeHandle device_n(n, devices[i]);
+        imus.push_back(new imu_3dm_gx3::Imu3dmGx3(io_service, device_n,
+                                                  ros::this_node::getName() + "/" + devices[i]));
+      }
+
+  for (size_t i = 0; i < imus.size(); i++)
+    if (!imus[i]->initialize(!align_timers))
+      {
+        close_all();
+        return -1;
+      }
+
+  if (align_timers && !imu_3dm_gx3::Imu3dmGx3::reset_timers(imus))
+    {
+      close_all();
+      return -1;
+    }
+
+  // The imus are stopped cleanly between two reads
+  signals = new boost::asio::signal_set(io_service, SIGINT, SIGTERM);
+  signals->async_wait(boost::bind(&stop_all));
+
+  running = imus.size();
+  for (size_t i = 0; i < imus.size(); i++)
+    {
+      imus[i]->set_stop_callback(boost::bind(&imu_stopped, &io_service));
+      imus[i]->start();
+    }
+
+  // Subscriptions such as the preintegration trigger are served here, the
+  // io_service threads never spin
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
+
+  // Handlers of one device never run concurrently, so extra threads only
+  // help with several devices
+  boost::thread_group pool;
+  for (int i = 1; i < threads; i++)
+    pool.create_thread(boost::bind(&run_io, &io_service, &n));
+  run_io(&io_service, &n);
+  pool.join_all();
+
+  close_all();
+  delete signals;
+
+  return 0;
+
+}
@@ -0,0 +1,53 @@
+// Nodelet interface to the Microstrain 3DM-GX3-25
+// N. Michael
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <imu_3dm_gx3/imu_3dm_gx3.h>
+
+namespace imu_3dm_gx3
+{
+
+// Runs the driver in its own thread so the handshake does not block the
+// nodelet manager. Published messages are shared with subscribers in the
+// same manager without serialization.
+class Imu3dmGx3Nodelet : public nodelet::Nodelet
+{
+public:
+  virtual ~Imu3dmGx3Nodelet()
+  {
+    if (imu_)
+      imu_->request_stop();
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+private:
+  virtual void onInit()
+  {
+    imu_.reset(new Imu3dmGx3(io_service_, getPrivateNodeHandle(), getName()));
+    thread_ = boost::thread(boost::bind(&Imu3dmGx3Nodelet::run, this));
+  }
+
+  void run()
+  {
+    if (!imu_->initialize())
+      return;
+
+    configure_io_thread(getPrivateNodeHandle(), getName());
+    imu_->start();
+    io_service_.run();
+    imu_->close();
+  }
+
+  boost::asio::io_service io_service_;
+  boost::scoped_ptr<Imu3dmGx3> imu_;
+  boost::thread thread_;
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(imu_3dm_gx3::Imu3dmGx3Nodelet, nodelet::Nodelet)
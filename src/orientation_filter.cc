@@ -0,0 +1,91 @@
+// Host side orientation fusion for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#include <cmath>
+#include <eigen3/Eigen/Geometry>
+#include <imu_3dm_gx3/orientation_filter.h>
+
+namespace imu_3dm_gx3
+{
+
+OrientationFilter::OrientationFilter(Method method, double gain) :
+  method_(method),
+  gain_(gain),
+  initialized_(false)
+{
+  q_[0] = 1.0;
+  q_[1] = q_[2] = q_[3] = 0.0;
+}
+
+// Tilt from gravity alone, then heading from the horizontal part of the
+// magnetic field
+void OrientationFilter::initialize(const double *accel, const double *mag)
+{
+  Eigen::Vector3d a(accel[0], accel[1], accel[2]);
+  if (a.squaredNorm() == 0.0)
+    return;
+
+  Eigen::Quaterniond q = Eigen::Quaterniond::FromTwoVectors(a, Eigen::Vector3d::UnitZ());
+  if (mag)
+    {
+      Eigen::Vector3d h = q * Eigen::Vector3d(mag[0], mag[1], mag[2]);
+      if (h.x() != 0.0 || h.y() != 0.0)
+        q = Eigen::AngleAxisd(-atan2(h.y(), h.x()), Eigen::Vector3d::UnitZ()) * q;
+    }
+
+  q.normalize();
+  q_[0] = q.w();
+  q_[1] = q.x();
+  q_[2] = q.y();
+  q_[3] = q.z();
+  initialized_ = true;
+}
+
+void OrientationFilter::update(const double *ang_vel, const double *accel,
+                               const double *mag, double dt)
+{
+  if (!initialized_)
+    {
+      initialize(accel, mag);
+      return;
+    }
+
+  Eigen::Quaterniond q(q_[0], q_[1], q_[2], q_[3]);
+  Eigen::Vector3d w(ang_vel[0], ang_vel[1], ang_vel[2]);
+  Eigen::Vector3d a(accel[0], accel[1], accel[2]);
+
+  // Free fall or a dead accelerometer leaves only the gyros
+  if (a.squaredNorm() > 0.0)
+    {
+      Eigen::Quaterniond qc = q.conjugate();
+      Eigen::Vector3d e = a.normalized().cross(qc * Eigen::Vector3d::UnitZ());
+
+      // The field is compared with its reference in the horizontal and
+      // vertical plane it lies in, so a wrong inclination costs no tilt
+      Eigen::Vector3d m = mag ? Eigen::Vector3d(mag[0], mag[1], mag[2]) : Eigen::Vector3d::Zero();
+      if (m.squaredNorm() > 0.0)
+        {
+          m.normalize();
+          Eigen::Vector3d h = q * m;
+          Eigen::Vector3d b(sqrt(h.x() * h.x() + h.y() * h.y()), 0.0, h.z());
+          e += m.cross(qc * b);
+        }
+
+      if (method_ == COMPLEMENTARY)
+        w += gain_ * e;
+      else if (e.squaredNorm() > 0.0)
+        w += 2.0 * gain_ * e.normalized();
+    }
+
+  double angle = w.norm() * dt;
+  if (angle > 0.0)
+    q = q * Eigen::Quaterniond(Eigen::AngleAxisd(angle, w.normalized()));
+  q.normalize();
+
+  q_[0] = q.w();
+  q_[1] = q.x();
+  q_[2] = q.y();
+  q_[3] = q.z();
+}
+
+}
@@ -0,0 +1,132 @@
+// IMU preintegration for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#include <cmath>
+#include <cstring>
+#include <eigen3/Eigen/Geometry>
+#include <imu_3dm_gx3/preintegration.h>
+
+namespace imu_3dm_gx3
+{
+
+typedef Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor> > Map3;
+typedef Eigen::Map<Eigen::Matrix<double, 9, 9, Eigen::RowMajor> > Map9;
+
+static Eigen::Matrix3d skew(const Eigen::Vector3d &v)
+{
+  Eigen::Matrix3d S;
+  S <<     0, -v(2),  v(1),
+        v(2),     0, -v(0),
+       -v(1),  v(0),     0;
+  return S;
+}
+
+// Rotation of the rotation vector 'phi' and the right Jacobian of SO(3)
+// at it
+static void exp_map(const Eigen::Vector3d &phi, Eigen::Matrix3d &R, Eigen::Matrix3d &Jr)
+{
+  double theta = phi.norm();
+  Eigen::Matrix3d S = skew(phi);
+  if (theta < 1e-8)
+    {
+      R = Eigen::Matrix3d::Identity() + S;
+      Jr = Eigen::Matrix3d::Identity() - 0.5 * S;
+      return;
+    }
+  R = Eigen::AngleAxisd(theta, phi / theta).toRotationMatrix();
+  Jr = Eigen::Matrix3d::Identity() - (1.0 - cos(theta)) / (theta * theta) * S +
+    (theta - sin(theta)) / (theta * theta * theta) * S * S;
+}
+
+Preintegrator::Preintegrator(double gyro_noise, double accel_noise) :
+  gyro_var_(gyro_noise * gyro_noise),
+  accel_var_(accel_noise * accel_noise)
+{
+  memset(gyro_bias_, 0, sizeof(gyro_bias_));
+  memset(accel_bias_, 0, sizeof(accel_bias_));
+  reset();
+}
+
+void Preintegrator::set_bias(const double *gyro_bias, const double *accel_bias)
+{
+  memcpy(gyro_bias_, gyro_bias, sizeof(gyro_bias_));
+  memcpy(accel_bias_, accel_bias, sizeof(accel_bias_));
+}
+
+void Preintegrator::reset()
+{
+  memcpy(window_gyro_bias_, gyro_bias_, sizeof(gyro_bias_));
+  memcpy(window_accel_bias_, accel_bias_, sizeof(accel_bias_));
+
+  samples_ = 0;
+  duration_ = 0.0;
+  Map3(dR_).setIdentity();
+  memset(dv_, 0, sizeof(dv_));
+  memset(dp_, 0, sizeof(dp_));
+  memset(dR_dbg_, 0, sizeof(dR_dbg_));
+  memset(dv_dbg_, 0, sizeof(dv_dbg_));
+  memset(dv_dba_, 0, sizeof(dv_dba_));
+  memset(dp_dbg_, 0, sizeof(dp_dbg_));
+  memset(dp_dba_, 0, sizeof(dp_dba_));
+  memset(cov_, 0, sizeof(cov_));
+}
+
+void Preintegrator::integrate(const double *ang_vel, const double *accel, double dt)
+{
+  Eigen::Vector3d w = Eigen::Vector3d(ang_vel[0], ang_vel[1], ang_vel[2]) -
+    Eigen::Map<const Eigen::Vector3d>(window_gyro_bias_);
+  Eigen::Vector3d a = Eigen::Vector3d(accel[0], accel[1], accel[2]) -
+    Eigen::Map<const Eigen::Vector3d>(window_accel_bias_);
+
+  Map3 dR(dR_), dR_dbg(dR_dbg_), dv_dbg(dv_dbg_), dv_dba(dv_dba_),
+    dp_dbg(dp_dbg_), dp_dba(dp_dba_);
+  Eigen::Map<Eigen::Vector3d> dv(dv_), dp(dp_);
+  Map9 cov(cov_);
+
+  Eigen::Matrix3d R_inc, Jr;
+  exp_map(w * dt, R_inc, Jr);
+  Eigen::Matrix3d I = Eigen::Matrix3d::Identity();
+  double dt2 = dt * dt;
+  Eigen::Matrix3d dR_a = dR * skew(a);
+
+  // Covariance, driven by the discretized white noise
+  Eigen::Matrix<double, 9, 9> A = Eigen::Matrix<double, 9, 9>::Identity();
+  A.block<3,3>(0,0) = R_inc.transpose();
+  A.block<3,3>(3,0) = -dR_a * dt;
+  A.block<3,3>(6,0) = -0.5 * dR_a * dt2;
+  A.block<3,3>(6,3) = I * dt;
+  Eigen::Matrix<double, 9, 3> B = Eigen::Matrix<double, 9, 3>::Zero();
+  Eigen::Matrix<double, 9, 3> C = Eigen::Matrix<double, 9, 3>::Zero();
+  B.block<3,3>(0,0) = Jr * dt;
+  C.block<3,3>(3,0) = dR * dt;
+  C.block<3,3>(6,0) = 0.5 * dR * dt2;
+  cov = A * cov * A.transpose() +
+    (gyro_var_ / dt) * B * B.transpose() + (accel_var_ / dt) * C * C.transpose();
+
+  // Bias Jacobians, position first since it uses the old velocity ones
+  dp_dba += dv_dba * dt - 0.5 * dR * dt2;
+  dp_dbg += dv_dbg * dt - 0.5 * dR_a * dR_dbg * dt2;
+  dv_dba -= dR * dt;
+  dv_dbg -= dR_a * dR_dbg * dt;
+  dR_dbg = R_inc.transpose() * dR_dbg - Jr * dt;
+
+  dp += dv * dt + 0.5 * dR * a * dt2;
+  dv += dR * a * dt;
+  dR = dR * R_inc;
+
+  samples_++;
+  duration_ += dt;
+}
+
+void Preintegrator::delta_quaternion(double *q) const
+{
+  Eigen::Matrix3d R = Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor> >(dR_);
+  Eigen::Quaterniond quat(R);
+  quat.normalize();
+  q[0] = quat.w();
+  q[1] = quat.x();
+  q[2] = quat.y();
+  q[3] = quat.z();
+}
+
+}
@@ -0,0 +1,41 @@
+// Data presets of the Microstrain 3DM-GX3-25 single byte protocol
+// N. Michael
+
+#include <imu_3dm_gx3/presets.h>
+
+namespace imu_3dm_gx3
+{
+
+static const Preset presets[] = {
+  // command, name, length, accel, ang_vel, mag, matrix, quaternion, euler,
+  // stabilized accel, stabilized mag, timer
+  {0xC2, "accel_ang_rate",                    31,  0,  3, -1, -1, -1, -1, -1, -1,  6},
+  {0xC5, "orientation",                       43, -1, -1, -1,  0, -1, -1, -1, -1,  9},
+  {0xC8, "accel_ang_rate_orientation",        67,  0,  3, -1,  6, -1, -1, -1, -1, 15},
+  {0xCB, "accel_ang_rate_mag",                43,  0,  3,  6, -1, -1, -1, -1, -1,  9},
+  {0xCC, "accel_ang_rate_mag_orientation",    79,  0,  3,  6,  9, -1, -1, -1, -1, 18},
+  {0xCE, "euler",                             19, -1, -1, -1, -1, -1,  0, -1, -1,  3},
+  {0xCF, "euler_ang_rate",                    31, -1,  3, -1, -1, -1,  0, -1, -1,  6},
+  {0xD2, "stabilized_accel_ang_rate_mag",     43, -1,  3, -1, -1, -1, -1,  0,  6,  9},
+  {0xDF, "quaternion",                        23, -1, -1, -1, -1,  0, -1, -1, -1,  4},
+};
+
+static const size_t num_presets = sizeof(presets) / sizeof(presets[0]);
+
+const Preset *find_preset(unsigned char command)
+{
+  for (size_t i = 0; i < num_presets; i++)
+    if (presets[i].command == command)
+      return &presets[i];
+  return 0;
+}
+
+const Preset *find_preset(const std::string &name)
+{
+  for (size_t i = 0; i < num_presets; i++)
+    if (name == presets[i].name)
+      return &presets[i];
+  return 0;
+}
+
+}
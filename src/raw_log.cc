@@ -0,0 +1,159 @@
+// Raw serial capture for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#include <imu_3dm_gx3/raw_log.h>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace imu_3dm_gx3
+{
+
+static const char magic[8] = {'G','X','3','R','A','W','0','1'};
+static const uint32_t byte_order_mark = 0x01020304;
+static const size_t header_length = 24;
+static const size_t record_header_length = 12;
+
+RawLogWriter::RawLogWriter() :
+  file_(0)
+{
+}
+
+RawLogWriter::~RawLogWriter()
+{
+  close();
+}
+
+bool RawLogWriter::open(const std::string &path, const RawLogHeader &header)
+{
+  close();
+  file_ = fopen(path.c_str(), "wb");
+  if (!file_)
+    return false;
+
+  unsigned char buf[header_length];
+  uint32_t preset = header.preset;
+  memcpy(buf, magic, 8);
+  memcpy(buf + 8, &byte_order_mark, 4);
+  memcpy(buf + 12, &preset, 4);
+  memcpy(buf + 16, &header.t0, 8);
+  if (fwrite(buf, 1, header_length, file_) != header_length)
+    {
+      close();
+      return false;
+    }
+  return true;
+}
+
+void RawLogWriter::close()
+{
+  if (file_)
+    fclose(file_);
+  file_ = 0;
+}
+
+bool RawLogWriter::write(int64_t received, const unsigned char *data, uint32_t length)
+{
+  if (!file_)
+    return false;
+
+  unsigned char buf[record_header_length];
+  memcpy(buf, &received, 8);
+  memcpy(buf + 8, &length, 4);
+  return fwrite(buf, 1, record_header_length, file_) == record_header_length &&
+    fwrite(data, 1, length, file_) == length;
+}
+
+RawLogReader::RawLogReader() :
+  map_(0),
+  size_(0),
+  offset_(0)
+{
+  header_.preset = 0;
+  header_.t0 = 0;
+}
+
+RawLogReader::~RawLogReader()
+{
+  close();
+}
+
+bool RawLogReader::open(const std::string &path)
+{
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < header_length)
+    {
+      ::close(fd);
+      return false;
+    }
+
+  void *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED)
+    return false;
+
+  map_ = (const unsigned char *)map;
+  size_ = st.st_size;
+  madvise(map, size_, MADV_SEQUENTIAL);
+
+  uint32_t mark, preset;
+  memcpy(&mark, map_ + 8, 4);
+  memcpy(&preset, map_ + 12, 4);
+  if (memcmp(map_, magic, 8) != 0 || mark != byte_order_mark)
+    {
+      close();
+      return false;
+    }
+
+  header_.preset = (unsigned char)preset;
+  memcpy(&header_.t0, map_ + 16, 8);
+  offset_ = header_length;
+  return true;
+}
+
+void RawLogReader::close()
+{
+  if (map_)
+    munmap((void *)map_, size_);
+  map_ = 0;
+  size_ = 0;
+  offset_ = 0;
+}
+
+bool RawLogReader::peek(int64_t &received) const
+{
+  if (!map_ || offset_ + record_header_length > size_)
+    return false;
+  memcpy(&received, map_ + offset_, 8);
+  return true;
+}
+
+void RawLogReader::rewind()
+{
+  offset_ = header_length;
+}
+
+bool RawLogReader::next(int64_t &received, const unsigned char *&data, uint32_t &length)
+{
+  if (!map_ || offset_ + record_header_length > size_)
+    return false;
+
+  memcpy(&received, map_ + offset_, 8);
+  memcpy(&length, map_ + offset_ + 8, 4);
+  if (offset_ + record_header_length + length > size_)
+    return false;
+
+  data = map_ + offset_ + record_header_length;
+  offset_ += record_header_length + length;
+  return true;
+}
+
+}
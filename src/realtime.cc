@@ -0,0 +1,54 @@
+// Real-time scheduling helpers for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <imu_3dm_gx3/realtime.h>
+
+namespace imu_3dm_gx3
+{
+
+bool set_thread_priority(int priority)
+{
+  sched_param param;
+  param.sched_priority = priority;
+  int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (error)
+    {
+      errno = error;
+      return false;
+    }
+  return true;
+}
+
+bool set_thread_affinity(const std::vector<int> &cpus)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < cpus.size(); i++)
+    {
+      if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE)
+        {
+          errno = EINVAL;
+          return false;
+        }
+      CPU_SET(cpus[i], &set);
+    }
+
+  int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (error)
+    {
+      errno = error;
+      return false;
+    }
+  return true;
+}
+
+bool lock_memory()
+{
+  return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+}
+
+}
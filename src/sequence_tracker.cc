@@ -0,0 +1,89 @@
+// Dropped sample detection for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#include <cmath>
+#include <imu_3dm_gx3/sequence_tracker.h>
+
+namespace imu_3dm_gx3
+{
+
+SequenceTracker::SequenceTracker(double expected) :
+  expected_(expected),
+  learned_steps_(0),
+  shortest_(0),
+  started_(false),
+  numbered_(false),
+  last_(0),
+  sequence_(0),
+  missed_(0),
+  dropped_(0),
+  duplicates_(0),
+  gaps_(0)
+{
+}
+
+void SequenceTracker::restart()
+{
+  started_ = false;
+}
+
+SequenceTracker::Result SequenceTracker::update(uint64_t ticks)
+{
+  if (!started_)
+    {
+      // The very first sample is number 0, after a restart the count goes on
+      if (numbered_)
+        sequence_++;
+      numbered_ = true;
+      started_ = true;
+      last_ = ticks;
+      missed_ = 0;
+      return FIRST;
+    }
+
+  // Until the period is known the shortest step so far stands in for it
+  double period = expected_ > 0.0 ? expected_ : (double)shortest_;
+  if (ticks < last_ && period > 0.0 && last_ - ticks > RESTART_PERIODS * period)
+    {
+      sequence_++;
+      last_ = ticks;
+      missed_ = 0;
+      return RESTART;
+    }
+
+  if (ticks <= last_ || (expected_ > 0.0 && ticks - last_ < 0.5 * expected_))
+    {
+      duplicates_++;
+      return DUPLICATE;
+    }
+
+  uint64_t step = ticks - last_;
+  last_ = ticks;
+  missed_ = 0;
+
+  if (expected_ <= 0.0)
+    {
+      // Lost samples only make steps longer, so the shortest one is the
+      // period
+      if (learned_steps_ == 0 || step < shortest_)
+        shortest_ = step;
+      if (++learned_steps_ >= LEARN_STEPS)
+        expected_ = shortest_;
+      sequence_++;
+      return NEXT;
+    }
+
+  // Steps are whole periods; rounding absorbs the alternating tick counts
+  // of periods that are not a whole number of ticks
+  uint64_t periods = (uint64_t)floor(step / expected_ + 0.5);
+  sequence_ += periods;
+  if (periods <= 1)
+    return NEXT;
+
+  missed_ = periods - 1;
+  dropped_ += missed_;
+  gaps_++;
+  return GAP;
+}
+
+}
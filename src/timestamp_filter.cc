@@ -0,0 +1,114 @@
+// Device to host clock estimation for the Microstrain 3DM-GX3-25
+// N. Michael
+
+#include <imu_3dm_gx3/timestamp_filter.h>
+
+namespace imu_3dm_gx3
+{
+
+TimestampFilter::TimestampFilter(double window, double bucket) :
+  window_(window),
+  bucket_(bucket)
+{
+  reset();
+}
+
+void TimestampFilter::reset()
+{
+  points_.clear();
+  hull_.clear();
+  bucket_open_ = false;
+  bucket_start_ = 0.0;
+  origin_ = 0.0;
+  offset_ = 0.0;
+  skew_ = 0.0;
+}
+
+double TimestampFilter::host_time(double device) const
+{
+  return device + offset_ + skew_ * (device - origin_);
+}
+
+double TimestampFilter::update(double device, double host)
+{
+  Point p;
+  p.x = device;
+  p.y = host - device;
+
+  if (bucket_open_ && device - bucket_start_ >= bucket_)
+    {
+      points_.push_back(current_);
+      while (!points_.empty() && device - points_.front().x > window_)
+        points_.pop_front();
+      bucket_open_ = false;
+      fit();
+    }
+
+  if (!bucket_open_)
+    {
+      bucket_open_ = true;
+      bucket_start_ = device;
+      current_ = p;
+    }
+  else if (p.y < current_.y)
+    current_ = p;
+
+  // Until the first bucket closes only a lower bound on the offset is known
+  if (points_.empty())
+    {
+      origin_ = current_.x;
+      offset_ = current_.y;
+      skew_ = 0.0;
+    }
+  // Never stamp a sample later than it was received
+  else if (host_time(device) > host)
+    {
+      offset_ -= host_time(device) - host;
+    }
+
+  return host_time(device);
+}
+
+void TimestampFilter::fit()
+{
+  // Lower hull by monotone chain, points are ordered by device time
+  hull_.clear();
+  double mean = 0.0;
+  for (size_t i = 0; i < points_.size(); i++)
+    {
+      const Point &p = points_[i];
+      mean += p.x;
+      while (hull_.size() >= 2)
+        {
+          const Point &a = hull_[hull_.size() - 2];
+          const Point &b = hull_[hull_.size() - 1];
+          // Drop b unless it lies strictly below the segment a-p
+          if ((b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x) <= 0.0)
+            hull_.pop_back();
+          else
+            break;
+        }
+      hull_.push_back(p);
+    }
+  mean /= points_.size();
+
+  if (hull_.size() == 1)
+    {
+      origin_ = hull_[0].x;
+      offset_ = hull_[0].y;
+      skew_ = 0.0;
+      return;
+    }
+
+  size_t k = 0;
+  while (k + 2 < hull_.size() && hull_[k + 1].x < mean)
+    k++;
+
+  const Point &a = hull_[k];
+  const Point &b = hull_[k + 1];
+  origin_ = a.x;
+  offset_ = a.y;
+  skew_ = (b.y - a.y) / (b.x - a.x);
+}
+
+}
@@ -0,0 +1,84 @@
+// Latency tracing for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#include <cstdio>
+#include <ctime>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <imu_3dm_gx3/trace.h>
+
+// Events kept, about four per sample
+#ifndef IMU_3DM_GX3_TRACE_EVENTS
+#define IMU_3DM_GX3_TRACE_EVENTS (1 << 18)
+#endif
+
+namespace imu_3dm_gx3
+{
+
+struct TraceRecord
+{
+  int64_t key;
+  int64_t time;
+  int point;
+};
+
+// Preallocated, so recording never allocates; a slot is claimed with one
+// atomic increment
+struct TraceRing
+{
+  TraceRing() : records(IMU_3DM_GX3_TRACE_EVENTS), next(0) {}
+
+  std::vector<TraceRecord> records;
+  boost::atomic<uint64_t> next;
+};
+
+static TraceRing &ring()
+{
+  static TraceRing instance;
+  return instance;
+}
+
+void trace_event(TracePoint point, int64_t key)
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  TraceRing &r = ring();
+  uint64_t slot = r.next.fetch_add(1, boost::memory_order_relaxed);
+  TraceRecord &record = r.records[slot % r.records.size()];
+  record.key = key;
+  record.time = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  record.point = point;
+}
+
+bool write_trace(const std::string &path)
+{
+  static const char *names[] = {"READ", "FRAME", "DECODE", "PUBLISH"};
+
+  FILE *file = fopen(path.c_str(), "w");
+  if (!file)
+    return false;
+
+  TraceRing &r = ring();
+  uint64_t end = r.next.load();
+  uint64_t size = r.records.size();
+  uint64_t begin = end > size ? end - size : 0;
+  for (uint64_t i = begin; i < end; i++)
+    {
+      const TraceRecord &record = r.records[i % size];
+      fprintf(file, "%s %lld %lld\n", names[record.point], (long long)record.key,
+              (long long)record.time);
+    }
+  return fclose(file) == 0;
+}
+
+bool trace_enabled()
+{
+#ifdef IMU_3DM_GX3_TRACE
+  return true;
+#else
+  return false;
+#endif
+}
+
+}
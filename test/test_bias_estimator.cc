@@ -0,0 +1,84 @@
+// Gyro bias estimation tests for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#include <cmath>
+#include <gtest/gtest.h>
+#include <imu_3dm_gx3/bias_estimator.h>
+
+using namespace imu_3dm_gx3;
+
+static const double bias[3] = {0.002, -0.001, 0.0005};
+// Sampled at 64 Hz, so chunks of 1/8 s end on exact sample times
+static const double dt = 1.0 / 64.0;
+
+// A resting gyro with a little deterministic noise
+static void at_rest(int i, double *ang_vel)
+{
+  for (int k = 0; k < 3; k++)
+    ang_vel[k] = bias[k] + 1e-3 * sin(1.7 * i + k);
+}
+
+TEST(StaticBiasEstimator, AveragesARestingGyro)
+{
+  StaticBiasEstimator estimator(1.0, 0.01, 0.125);
+  int finished = -1;
+  for (int i = 0; i < 300; i++)
+    {
+      double ang_vel[3];
+      at_rest(i, ang_vel);
+      if (estimator.update(i * dt, ang_vel))
+        {
+          EXPECT_EQ(-1, finished) << "reported twice";
+          finished = i;
+        }
+    }
+
+  // Done with the chunk that ends one second in
+  EXPECT_EQ(64, finished);
+  ASSERT_TRUE(estimator.done());
+  EXPECT_EQ(0u, estimator.restarts());
+  for (int k = 0; k < 3; k++)
+    EXPECT_NEAR(bias[k], estimator.bias()[k], 1e-4);
+}
+
+TEST(StaticBiasEstimator, StartsOverAfterMotion)
+{
+  StaticBiasEstimator estimator(1.0, 0.01, 0.125);
+  int finished = -1;
+  for (int i = 0; i < 400 && finished < 0; i++)
+    {
+      double ang_vel[3];
+      at_rest(i, ang_vel);
+      // Picked up and turned for the three chunks after sample 48
+      if (i > 48 && i <= 72)
+        ang_vel[2] += 0.5;
+      if (estimator.update(i * dt, ang_vel))
+        finished = i;
+    }
+
+  // The window starts again at the first chunk of motion and once more
+  // at the first chunk at rest after it
+  EXPECT_EQ(2u, estimator.restarts());
+  EXPECT_EQ(72 + 64, finished);
+  ASSERT_TRUE(estimator.done());
+  for (int k = 0; k < 3; k++)
+    EXPECT_NEAR(bias[k], estimator.bias()[k], 1e-4);
+}
+
+TEST(StaticBiasEstimator, ResetDiscardsTheEstimate)
+{
+  StaticBiasEstimator estimator(0.5, 0.01, 0.125);
+  for (int i = 0; i <= 32; i++)
+    {
+      double ang_vel[3];
+      at_rest(i, ang_vel);
+      estimator.update(i * dt, ang_vel);
+    }
+  ASSERT_TRUE(estimator.done());
+
+  estimator.reset();
+  EXPECT_FALSE(estimator.done());
+  EXPECT_EQ(0.0, estimator.bias()[0]);
+  double ang_vel[3] = {0.0, 0.0, 0.0};
+  EXPECT_FALSE(estimator.update(1.0, ang_vel));
+}
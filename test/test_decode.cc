@@ -0,0 +1,88 @@
+// Frame encoding tests for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#include <cstring>
+#include <vector>
+#include <gtest/gtest.h>
+#include <imu_3dm_gx3/decode.h>
+#include <imu_3dm_gx3/frame_parser.h>
+#include <imu_3dm_gx3/presets.h>
+
+using namespace imu_3dm_gx3;
+
+// Every field set to a value of its own
+static Sample make_sample()
+{
+  Sample sample;
+  float *fields[] = {sample.accel, sample.ang_vel, sample.mag, sample.stab_accel,
+                     sample.stab_mag, sample.euler};
+  for (int f = 0; f < 6; f++)
+    for (int i = 0; i < 3; i++)
+      fields[f][i] = 0.25f * f - 1.5f * i + 0.125f;
+  for (int i = 0; i < 9; i++)
+    sample.M[i] = -0.5f + 0.0625f * i;
+  for (int i = 0; i < 4; i++)
+    sample.q[i] = 0.5f - 0.25f * i;
+  sample.timer = 0xFEDCBA98u;
+  return sample;
+}
+
+static void expect_field(int word, const float *in, const float *out, int count,
+                         const char *name)
+{
+  if (word < 0)
+    return;
+  for (int i = 0; i < count; i++)
+    EXPECT_EQ(in[i], out[i]) << name << "[" << i << "]";
+}
+
+TEST(Decode, RoundTripsEveryPreset)
+{
+  int presets = 0;
+  for (int command = 0; command < 256; command++)
+    {
+      const Preset *preset = find_preset((unsigned char)command);
+      if (!preset)
+        continue;
+      presets++;
+      SCOPED_TRACE(preset->name);
+
+      Sample in = make_sample();
+      std::vector<unsigned char> frame(preset->length);
+      encode_frame(*preset, in, &frame[0]);
+      EXPECT_EQ(command, frame[0]);
+      EXPECT_TRUE(validate_checksum(&frame[0], frame.size()));
+
+      Sample out;
+      memset(&out, 0, sizeof(out));
+      decode_frame(*preset, &frame[0], out);
+      expect_field(preset->accel, in.accel, out.accel, 3, "accel");
+      expect_field(preset->ang_vel, in.ang_vel, out.ang_vel, 3, "ang_vel");
+      expect_field(preset->mag, in.mag, out.mag, 3, "mag");
+      expect_field(preset->orientation_matrix, in.M, out.M, 9, "M");
+      expect_field(preset->quaternion, in.q, out.q, 4, "q");
+      expect_field(preset->euler, in.euler, out.euler, 3, "euler");
+      expect_field(preset->stab_accel, in.stab_accel, out.stab_accel, 3, "stab_accel");
+      expect_field(preset->stab_mag, in.stab_mag, out.stab_mag, 3, "stab_mag");
+      EXPECT_EQ(in.timer, out.timer);
+
+      // The timer is the last word, right before the checksum
+      EXPECT_EQ((size_t)(preset->timer + 1) * 4 + 3, preset->length);
+    }
+  EXPECT_EQ(9, presets);
+}
+
+TEST(Decode, WordsAreBigEndian)
+{
+  const Preset &preset = *find_preset(0xCC);
+  Sample in = make_sample();
+  in.accel[0] = 1.0f;
+  in.timer = 0x01020304u;
+  std::vector<unsigned char> frame(preset.length);
+  encode_frame(preset, in, &frame[0]);
+
+  const unsigned char one[4] = {0x3F, 0x80, 0x00, 0x00};
+  EXPECT_EQ(0, memcmp(one, &frame[1], 4));
+  const unsigned char timer[4] = {0x01, 0x02, 0x03, 0x04};
+  EXPECT_EQ(0, memcmp(timer, &frame[1 + 4 * preset.timer], 4));
+}
@@ -0,0 +1,202 @@
+// Frame parser tests for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+#include <gtest/gtest.h>
+#include <imu_3dm_gx3/decode.h>
+#include <imu_3dm_gx3/frame_parser.h>
+#include <imu_3dm_gx3/presets.h>
+
+using namespace imu_3dm_gx3;
+
+static const Preset &preset()
+{
+  return *find_preset(0xCC);
+}
+
+// Frame number 'n' of a 0xCC stream, told apart by its timer
+static std::vector<unsigned char> make_frame(unsigned int n)
+{
+  Sample sample;
+  memset(&sample, 0, sizeof(sample));
+  for (int i = 0; i < 3; i++)
+    {
+      sample.accel[i] = i == 2 ? -1.0f : 0.01f * i;
+      sample.ang_vel[i] = 0.001f * n;
+      sample.mag[i] = 0.3f;
+    }
+  for (int i = 0; i < 9; i++)
+    sample.M[i] = i % 4 == 0 ? 1.0f : 0.0f;
+  sample.timer = n * 625;
+
+  std::vector<unsigned char> frame(preset().length);
+  encode_frame(preset(), sample, &frame[0]);
+  return frame;
+}
+
+static std::vector<unsigned char> make_stream(unsigned int frames)
+{
+  std::vector<unsigned char> stream;
+  for (unsigned int n = 0; n < frames; n++)
+    {
+      std::vector<unsigned char> frame = make_frame(n);
+      stream.insert(stream.end(), frame.begin(), frame.end());
+    }
+  return stream;
+}
+
+// Timers of every frame the parser hands out
+static std::vector<uint32_t> drain(FrameParser &parser)
+{
+  std::vector<uint32_t> timers;
+  std::vector<unsigned char> frame(parser.frame_length());
+  while (parser.next(&frame[0]))
+    {
+      Sample sample;
+      decode_frame(preset(), &frame[0], sample);
+      timers.push_back(sample.timer);
+    }
+  return timers;
+}
+
+// Timers of frames 0 to frames - 1, without 'missing'
+static std::vector<uint32_t> expected_timers(unsigned int frames, int missing = -1)
+{
+  std::vector<uint32_t> timers;
+  for (unsigned int n = 0; n < frames; n++)
+    if ((int)n != missing)
+      timers.push_back(n * 625);
+  return timers;
+}
+
+TEST(Checksum, AcceptsOnlyIntactFrames)
+{
+  std::vector<unsigned char> frame = make_frame(3);
+  EXPECT_TRUE(validate_checksum(&frame[0], frame.size()));
+
+  std::vector<unsigned char> payload = frame;
+  payload[10] ^= 0x01;
+  EXPECT_FALSE(validate_checksum(&payload[0], payload.size()));
+
+  std::vector<unsigned char> checksum = frame;
+  checksum[frame.size() - 1] ^= 0x80;
+  EXPECT_FALSE(validate_checksum(&checksum[0], checksum.size()));
+}
+
+TEST(Checksum, IsASumOfAllBytes)
+{
+  // A plain 16 bit sum, so reordered bytes go unnoticed
+  std::vector<unsigned char> frame = make_frame(3);
+  std::swap(frame[5], frame[9]);
+  EXPECT_TRUE(validate_checksum(&frame[0], frame.size()));
+}
+
+TEST(FrameParser, WaitsForACompleteFrame)
+{
+  FrameParser parser(preset().command, preset().length);
+  std::vector<unsigned char> frame = make_frame(0);
+  std::vector<unsigned char> out(frame.size());
+
+  parser.feed(&frame[0], frame.size() - 1);
+  EXPECT_FALSE(parser.next(&out[0]));
+  EXPECT_EQ(frame.size() - 1, parser.buffered());
+
+  parser.feed(&frame[frame.size() - 1], 1);
+  ASSERT_TRUE(parser.next(&out[0]));
+  EXPECT_EQ(frame, out);
+  EXPECT_EQ(0u, parser.buffered());
+  EXPECT_EQ(0u, parser.resyncs());
+}
+
+TEST(FrameParser, JoinsFramesSplitAnywhere)
+{
+  std::vector<unsigned char> stream = make_stream(3);
+  for (size_t split = 0; split <= stream.size(); split++)
+    {
+      FrameParser parser(preset().command, preset().length);
+      parser.feed(&stream[0], split);
+      std::vector<uint32_t> timers = drain(parser);
+      parser.feed(&stream[0] + split, stream.size() - split);
+      std::vector<uint32_t> rest = drain(parser);
+      timers.insert(timers.end(), rest.begin(), rest.end());
+
+      EXPECT_EQ(expected_timers(3), timers) << "split at " << split;
+      EXPECT_EQ(0u, parser.bytes_discarded());
+    }
+}
+
+TEST(FrameParser, ResyncsAfterLeadingGarbage)
+{
+  // Including stray header bytes, whose candidates fail the checksum
+  std::vector<unsigned char> stream(37, 0x5A);
+  stream[4] = preset().command;
+  stream[30] = preset().command;
+  std::vector<unsigned char> frames = make_stream(5);
+  stream.insert(stream.end(), frames.begin(), frames.end());
+
+  FrameParser parser(preset().command, preset().length);
+  parser.feed(&stream[0], stream.size());
+  EXPECT_EQ(expected_timers(5), drain(parser));
+  EXPECT_EQ(1u, parser.resyncs());
+  EXPECT_EQ(37u, parser.bytes_discarded());
+  EXPECT_EQ(2u, parser.checksum_failures());
+}
+
+TEST(FrameParser, CorruptedByteCostsOneFrame)
+{
+  std::vector<unsigned char> stream = make_stream(10);
+  stream[4 * preset().length + 20] ^= 0x10;
+
+  FrameParser parser(preset().command, preset().length);
+  parser.feed(&stream[0], stream.size());
+  EXPECT_EQ(expected_timers(10, 4), drain(parser));
+  EXPECT_EQ(1u, parser.resyncs());
+  EXPECT_GE(parser.checksum_failures(), 1u);
+  EXPECT_EQ(preset().length, parser.bytes_discarded());
+}
+
+TEST(FrameParser, DroppedByteCostsOneFrame)
+{
+  std::vector<unsigned char> stream = make_stream(10);
+  stream.erase(stream.begin() + 4 * preset().length + 33);
+
+  FrameParser parser(preset().command, preset().length);
+  parser.feed(&stream[0], stream.size());
+  EXPECT_EQ(expected_timers(10, 4), drain(parser));
+  EXPECT_EQ(1u, parser.resyncs());
+  EXPECT_EQ(preset().length - 1, parser.bytes_discarded());
+}
+
+TEST(FrameParser, HandsOutFramesWrappingAroundTheRing)
+{
+  // The smallest ring and reads that do not line up with frames, so most
+  // frames wrap around its end
+  std::vector<unsigned char> stream = make_stream(20);
+  FrameParser parser(preset().command, preset().length, 0);
+  std::vector<uint32_t> timers;
+  for (size_t i = 0; i < stream.size(); i += 50)
+    {
+      parser.feed(&stream[i], std::min((size_t)50, stream.size() - i));
+      std::vector<uint32_t> some = drain(parser);
+      timers.insert(timers.end(), some.begin(), some.end());
+    }
+  EXPECT_EQ(expected_timers(20), timers);
+  EXPECT_EQ(0u, parser.bytes_discarded());
+}
+
+TEST(FrameParser, KeepsTheNewestBytesWhenFull)
+{
+  // 200 bytes hold the tail of frame 7 and frames 8 and 9
+  std::vector<unsigned char> stream = make_stream(10);
+  FrameParser parser(preset().command, preset().length, 200);
+  parser.feed(&stream[0], stream.size());
+
+  std::vector<uint32_t> timers = drain(parser);
+  ASSERT_EQ(2u, timers.size());
+  EXPECT_EQ(8u * 625, timers[0]);
+  EXPECT_EQ(9u * 625, timers[1]);
+  EXPECT_EQ(stream.size() - 2 * preset().length, parser.bytes_discarded());
+}
@@ -0,0 +1,280 @@
+// Driver tests against the emulated Microstrain 3DM-GX3-25
+// N. Michael
+
+#include <csignal>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <gtest/gtest.h>
+#include <imu_3dm_gx3/gx3_driver.h>
+
+// Set by the build to the emulator it built
+#ifndef IMU_3DM_GX3_EMULATOR
+#define IMU_3DM_GX3_EMULATOR "imu_3dm_gx3_emulator"
+#endif
+
+using namespace imu_3dm_gx3;
+
+// Runs imu_3dm_gx3_emulator with a link of its own for the test and a
+// Gx3Driver on an io_service of its own, and records what the driver
+// hands out
+class Gx3DriverTest : public ::testing::Test
+{
+protected:
+  Gx3DriverTest() : emulator_(-1), driver_(io_service_) {}
+
+  void SetUp()
+  {
+    static int tests = 0;
+    char link[64];
+    snprintf(link, sizeof(link), "/tmp/imu_3dm_gx3_test_%d_%d", (int)getpid(), tests++);
+    link_ = link;
+    record(driver_);
+  }
+
+  void TearDown()
+  {
+    driver_.close();
+    stop_emulator();
+  }
+
+  void record(Gx3Driver &driver)
+  {
+    driver.set_log_callback(boost::bind(&Gx3DriverTest::on_log, this, _1, _2));
+    driver.set_sample_callback(boost::bind(&Gx3DriverTest::on_sample, this, _1, _2));
+  }
+
+  // Start the emulator with 'options' and wait for its port
+  bool start_emulator(const std::vector<std::string> &options)
+  {
+    std::vector<std::string> args;
+    args.push_back(IMU_3DM_GX3_EMULATOR);
+    args.push_back("--link");
+    args.push_back(link_);
+    args.push_back("--duration");
+    args.push_back("60");
+    args.insert(args.end(), options.begin(), options.end());
+
+    emulator_ = fork();
+    if (emulator_ == 0)
+      {
+        std::vector<char*> argv;
+        for (size_t i = 0; i < args.size(); i++)
+          argv.push_back(const_cast<char*>(args[i].c_str()));
+        argv.push_back(0);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execvp(argv[0], &argv[0]);
+        _exit(127);
+      }
+    if (emulator_ < 0)
+      return false;
+
+    for (int i = 0; i < 500; i++)
+      {
+        struct stat st;
+        if (lstat(link_.c_str(), &st) == 0)
+          return true;
+        if (waitpid(emulator_, 0, WNOHANG) == emulator_)
+          {
+            emulator_ = -1;
+            return false;
+          }
+        usleep(10000);
+      }
+    return false;
+  }
+
+  void stop_emulator()
+  {
+    if (emulator_ <= 0)
+      return;
+    kill(emulator_, SIGTERM);
+    waitpid(emulator_, 0, 0);
+    emulator_ = -1;
+  }
+
+  Gx3Driver::Config config() const
+  {
+    Gx3Driver::Config config;
+    config.port = link_;
+    return config;
+  }
+
+  // Stream for 'seconds' on the test thread
+  void run(double seconds)
+  {
+    driver_.start();
+    boost::asio::deadline_timer timer(io_service_);
+    timer.expires_from_now(boost::posix_time::microseconds((long)(seconds * 1e6)));
+    timer.async_wait(driver_.strand().wrap(boost::bind(&Gx3Driver::stop, &driver_)));
+    io_service_.run();
+    io_service_.reset();
+  }
+
+  // Log messages containing 'text'
+  int logged(const std::string &text) const
+  {
+    int count = 0;
+    for (size_t i = 0; i < logs_.size(); i++)
+      if (logs_[i].find(text) != std::string::npos)
+        count++;
+    return count;
+  }
+
+  // Poll 'count' times, 20 ms apart, from the first timer expiry on
+  void poll_every(boost::asio::deadline_timer &timer, int count)
+  {
+    if (count == 0)
+      return;
+    timer.expires_from_now(boost::posix_time::milliseconds(20));
+    timer.async_wait(boost::bind(&Gx3DriverTest::handle_poll_timer, this,
+                                 boost::ref(timer), count));
+  }
+
+  void handle_poll_timer(boost::asio::deadline_timer &timer, int count)
+  {
+    driver_.poll();
+    poll_every(timer, count - 1);
+  }
+
+  void on_log(Gx3Driver::LogLevel, const std::string &message) { logs_.push_back(message); }
+  void on_sample(const Sample &sample, int64_t) { timers_.push_back(sample.timer); }
+
+  std::string link_;
+  pid_t emulator_;
+  boost::asio::io_service io_service_;
+  Gx3Driver driver_;
+  std::vector<std::string> logs_;
+  std::vector<uint32_t> timers_;
+};
+
+TEST_F(Gx3DriverTest, HandshakeSetsRateAndBaud)
+{
+  ASSERT_TRUE(start_emulator(std::vector<std::string>()));
+  Gx3Driver::Config c = config();
+  c.rate = 200;
+  c.target_baud = 230400;
+  c.reconnect = false;
+  ASSERT_TRUE(driver_.open(c));
+  EXPECT_EQ(1, logged("data rate 200 Hz"));
+  EXPECT_EQ(1, logged("link running at 230400 baud"));
+
+  run(1.0);
+  // One second at 200 Hz, consecutive samples 312 or 313 ticks apart
+  EXPECT_NEAR(200.0, timers_.size(), 20.0);
+  for (size_t i = 1; i < timers_.size(); i++)
+    EXPECT_NEAR(312.5, (double)(timers_[i] - timers_[i - 1]), 1.0) << "sample " << i;
+  EXPECT_EQ(0u, driver_.parser().checksum_failures());
+}
+
+TEST_F(Gx3DriverTest, QuickStartFindsTheStream)
+{
+  std::vector<std::string> options;
+  options.push_back("--streaming");
+  ASSERT_TRUE(start_emulator(options));
+  ASSERT_TRUE(driver_.open(config()));
+  EXPECT_EQ(1, logged("configuration skipped"));
+
+  run(0.5);
+  EXPECT_GT(timers_.size(), 20u);
+}
+
+TEST_F(Gx3DriverTest, ReconnectsAfterAPowerCycle)
+{
+  std::vector<std::string> options;
+  options.push_back("--reset-every");
+  options.push_back("1.0");
+  ASSERT_TRUE(start_emulator(options));
+  Gx3Driver::Config c = config();
+  c.read_timeout = 0.3;
+  c.reconnect_delay = 0.05;
+  ASSERT_TRUE(driver_.open(c));
+  int64_t t0 = driver_.t0();
+
+  run(2.8);
+  EXPECT_EQ(2u, driver_.reconnects());
+  EXPECT_NE(t0, driver_.t0());
+  // Streaming again after the last power cycle, with a fresh timer
+  ASSERT_GT(timers_.size(), 100u);
+  EXPECT_LT(timers_.back(), 62500u);
+}
+
+TEST_F(Gx3DriverTest, PersistStoresSettingsTheDeviceAlreadyRuns)
+{
+  std::vector<std::string> options;
+  options.push_back("--reset-every");
+  options.push_back("1.5");
+  ASSERT_TRUE(start_emulator(options));
+  Gx3Driver::Config c = config();
+  c.rate = 200;
+  c.target_baud = 230400;
+  c.read_timeout = 0.3;
+  c.reconnect_delay = 0.05;
+
+  // Set up by a run without persist first, so the settings are in effect
+  // but not stored
+  ASSERT_TRUE(driver_.open(c));
+  driver_.close();
+  logs_.clear();
+
+  c.persist = true;
+  ASSERT_TRUE(driver_.open(c));
+  // Sampling and baud, although both already match
+  EXPECT_EQ(2, logged("stored in EEPROM"));
+  EXPECT_EQ(1, logged("230400 baud, stored in EEPROM"));
+  logs_.clear();
+
+  // After the power cycle the device boots with them: it answers at the
+  // stored baud right away and nothing is written again
+  run(1.8);
+  EXPECT_EQ(1u, driver_.reconnects());
+  EXPECT_EQ(0, logged("trying 115200"));
+  EXPECT_EQ(0, logged("stored in EEPROM"));
+  EXPECT_EQ(1, logged("sampling settings already in effect"));
+}
+
+TEST_F(Gx3DriverTest, PollsOneSampleAtATime)
+{
+  ASSERT_TRUE(start_emulator(std::vector<std::string>()));
+  Gx3Driver::Config c = config();
+  c.polled = true;
+  c.reconnect = false;
+  ASSERT_TRUE(driver_.open(c));
+
+  boost::asio::deadline_timer timer(io_service_);
+  poll_every(timer, 20);
+  run(0.6);
+
+  EXPECT_EQ(20u, driver_.polls());
+  EXPECT_EQ(20u, timers_.size());
+  EXPECT_EQ(0u, driver_.poll_misses());
+}
+
+TEST_F(Gx3DriverTest, ReplaysACapture)
+{
+  ASSERT_TRUE(start_emulator(std::vector<std::string>()));
+  std::string capture = link_ + ".raw";
+  Gx3Driver::Config c = config();
+  c.reconnect = false;
+  ASSERT_TRUE(driver_.open(c));
+  ASSERT_TRUE(driver_.open_capture(capture));
+  run(0.5);
+  driver_.close();
+  std::vector<uint32_t> live = timers_;
+  ASSERT_GT(live.size(), 20u);
+
+  timers_.clear();
+  Gx3Driver replay(io_service_);
+  record(replay);
+  ASSERT_TRUE(replay.open_replay(capture));
+  replay.start();
+  io_service_.run();
+  unlink(capture.c_str());
+  EXPECT_EQ(live, timers_);
+}
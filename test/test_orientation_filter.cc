@@ -0,0 +1,95 @@
+// Orientation fusion tests for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#include <cmath>
+#include <eigen3/Eigen/Geometry>
+#include <gtest/gtest.h>
+#include <imu_3dm_gx3/orientation_filter.h>
+
+using namespace imu_3dm_gx3;
+
+// Specific force and field in the z up, x north frame, with a 60 degree dip
+static const Eigen::Vector3d up(0.0, 0.0, 9.81);
+static const Eigen::Vector3d field(0.25, 0.0, -0.43);
+
+static Eigen::Quaterniond estimate(const OrientationFilter &filter)
+{
+  const double *q = filter.quaternion();
+  return Eigen::Quaterniond(q[0], q[1], q[2], q[3]);
+}
+
+// 'iterations' samples at 100 Hz of a device held still at 'pose'
+static void hold(OrientationFilter &filter, const Eigen::Quaterniond &pose,
+                 int iterations, bool with_mag = true)
+{
+  Eigen::Vector3d a = pose.conjugate() * up, m = pose.conjugate() * field;
+  double w[3] = {0.0, 0.0, 0.0};
+  for (int i = 0; i < iterations; i++)
+    filter.update(w, a.data(), with_mag ? m.data() : NULL, 0.01);
+}
+
+static Eigen::Quaterniond tilted()
+{
+  return Eigen::Quaterniond(Eigen::AngleAxisd(1.2, Eigen::Vector3d::UnitZ()) *
+                            Eigen::AngleAxisd(0.3, Eigen::Vector3d::UnitY()) *
+                            Eigen::AngleAxisd(-0.4, Eigen::Vector3d::UnitX()));
+}
+
+TEST(OrientationFilter, InitializesFromGravityAndField)
+{
+  OrientationFilter filter;
+  EXPECT_FALSE(filter.initialized());
+  hold(filter, tilted(), 1);
+  ASSERT_TRUE(filter.initialized());
+  EXPECT_NEAR(0.0, tilted().angularDistance(estimate(filter)), 1e-9);
+
+  filter.reset();
+  EXPECT_FALSE(filter.initialized());
+  hold(filter, Eigen::Quaterniond::Identity(), 1);
+  EXPECT_NEAR(0.0, Eigen::Quaterniond::Identity().angularDistance(estimate(filter)), 1e-9);
+}
+
+TEST(OrientationFilter, IntegratesTheAngularRate)
+{
+  // Without correction only the gyros count
+  OrientationFilter filter(OrientationFilter::COMPLEMENTARY, 0.0);
+  hold(filter, Eigen::Quaterniond::Identity(), 1);
+  Eigen::Vector3d a = up, m = field;
+  double w[3] = {0.0, 0.0, 0.5};
+  for (int i = 0; i < 200; i++)
+    filter.update(w, a.data(), m.data(), 0.01);
+
+  Eigen::Quaterniond expected(Eigen::AngleAxisd(1.0, Eigen::Vector3d::UnitZ()));
+  EXPECT_NEAR(0.0, expected.angularDistance(estimate(filter)), 1e-9);
+}
+
+TEST(OrientationFilter, ConvergesToTheMeasuredPose)
+{
+  OrientationFilter::Method methods[] = {OrientationFilter::MADGWICK,
+                                         OrientationFilter::COMPLEMENTARY};
+  double gains[] = {0.1, 4.0};
+  for (int k = 0; k < 2; k++)
+    {
+      OrientationFilter filter(methods[k], gains[k]);
+      hold(filter, Eigen::Quaterniond::Identity(), 1);
+      hold(filter, tilted(), 3000);
+      // Madgwick's correction has a fixed size, so it settles to within
+      // one step of 2 gain dt
+      EXPECT_LT(tilted().angularDistance(estimate(filter)), 2e-3) << "method " << k;
+    }
+}
+
+TEST(OrientationFilter, KeepsTheHeadingWithoutField)
+{
+  // Tilt is corrected, the heading has nothing to follow
+  OrientationFilter filter(OrientationFilter::COMPLEMENTARY, 1.0);
+  hold(filter, Eigen::Quaterniond::Identity(), 1, false);
+  Eigen::Quaterniond pose(Eigen::AngleAxisd(0.3, Eigen::Vector3d::UnitX()));
+  hold(filter, Eigen::Quaterniond(Eigen::AngleAxisd(1.0, Eigen::Vector3d::UnitZ())) * pose,
+       3000, false);
+  EXPECT_LT(pose.angularDistance(estimate(filter)), 1e-3);
+
+  Eigen::Vector3d gravity = estimate(filter).conjugate() * Eigen::Vector3d::UnitZ();
+  Eigen::Vector3d measured = pose.conjugate() * Eigen::Vector3d::UnitZ();
+  EXPECT_TRUE(gravity.isApprox(measured, 1e-3));
+}
@@ -0,0 +1,162 @@
+// Preintegration tests for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#include <cmath>
+#include <eigen3/Eigen/Geometry>
+#include <gtest/gtest.h>
+#include <imu_3dm_gx3/preintegration.h>
+
+using namespace imu_3dm_gx3;
+
+typedef Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor> > ConstMap3;
+typedef Eigen::Map<const Eigen::Vector3d> ConstMap;
+
+static const double dt = 0.01;
+static const int steps = 100;
+
+// A tumbling, accelerating motion, the same on every call
+static void motion(int i, double *w, double *a)
+{
+  double t = i * dt;
+  w[0] = 0.3 * sin(2.0 * t);
+  w[1] = -0.2 + 0.4 * cos(1.5 * t);
+  w[2] = 0.7;
+  a[0] = 1.0 + 0.5 * cos(t);
+  a[1] = -0.3 * sin(3.0 * t);
+  a[2] = 9.8 + 0.2 * t;
+}
+
+static void integrate_motion(Preintegrator &preint)
+{
+  preint.reset();
+  for (int i = 0; i < steps; i++)
+    {
+      double w[3], a[3];
+      motion(i, w, a);
+      preint.integrate(w, a, dt);
+    }
+}
+
+static Eigen::Vector3d log_map(const Eigen::Matrix3d &R)
+{
+  Eigen::AngleAxisd aa(R);
+  return aa.angle() * aa.axis();
+}
+
+TEST(Preintegrator, IntegratesConstantRotation)
+{
+  Preintegrator preint;
+  double w[3] = {0.0, 0.0, 0.5}, a[3] = {0.0, 0.0, 0.0};
+  for (int i = 0; i < 200; i++)
+    preint.integrate(w, a, dt);
+
+  Eigen::Matrix3d expected = Eigen::AngleAxisd(1.0, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+  EXPECT_TRUE(ConstMap3(preint.delta_rotation()).isApprox(expected, 1e-12));
+  EXPECT_NEAR(2.0, preint.duration(), 1e-12);
+  EXPECT_EQ(200, preint.samples());
+
+  double q[4];
+  preint.delta_quaternion(q);
+  EXPECT_NEAR(cos(0.5), q[0], 1e-12);
+  EXPECT_NEAR(sin(0.5), q[3], 1e-12);
+}
+
+TEST(Preintegrator, IntegratesConstantAcceleration)
+{
+  Preintegrator preint;
+  double w[3] = {0.0, 0.0, 0.0}, a[3] = {1.0, -2.0, 3.0};
+  for (int i = 0; i < steps; i++)
+    preint.integrate(w, a, dt);
+
+  // Exact for a constant acceleration over T = 1 s
+  for (int i = 0; i < 3; i++)
+    {
+      EXPECT_NEAR(a[i], preint.delta_velocity()[i], 1e-12);
+      EXPECT_NEAR(0.5 * a[i], preint.delta_position()[i], 1e-12);
+    }
+}
+
+TEST(Preintegrator, BiasIsSubtractedFromTheNextWindow)
+{
+  Preintegrator preint;
+  double gyro_bias[3] = {0.0, 0.0, 0.1}, accel_bias[3] = {0.5, 0.0, 0.0};
+  double w[3] = {0.0, 0.0, 0.1}, a[3] = {0.5, 0.0, 0.0};
+
+  preint.set_bias(gyro_bias, accel_bias);
+  preint.integrate(w, a, dt);
+  EXPECT_NEAR(0.5 * dt, preint.delta_velocity()[0], 1e-12);
+
+  preint.reset();
+  EXPECT_DOUBLE_EQ(0.1, preint.gyro_bias()[2]);
+  preint.integrate(w, a, dt);
+  EXPECT_TRUE(ConstMap3(preint.delta_rotation()).isIdentity(1e-12));
+  EXPECT_NEAR(0.0, preint.delta_velocity()[0], 1e-12);
+}
+
+// First order bias correction against reintegrating with the changed bias
+TEST(Preintegrator, BiasJacobiansMatchFiniteDifferences)
+{
+  const double zero[3] = {0.0, 0.0, 0.0};
+  Preintegrator nominal;
+  integrate_motion(nominal);
+  Eigen::Matrix3d R0 = ConstMap3(nominal.delta_rotation());
+  Eigen::Vector3d v0 = ConstMap(nominal.delta_velocity());
+  Eigen::Vector3d p0 = ConstMap(nominal.delta_position());
+
+  const double h = 1e-5;
+  for (int k = 0; k < 3; k++)
+    {
+      double bias[3] = {0.0, 0.0, 0.0};
+      bias[k] = h;
+      Eigen::Vector3d db = Eigen::Vector3d::Zero();
+      db(k) = h;
+
+      Preintegrator gyro;
+      gyro.set_bias(bias, zero);
+      integrate_motion(gyro);
+      Eigen::Vector3d dphi = log_map(R0.transpose() * ConstMap3(gyro.delta_rotation()));
+      EXPECT_TRUE(dphi.isApprox(ConstMap3(nominal.d_rotation_d_gyro_bias()) * db, 1e-3))
+        << "rotation, gyro bias " << k;
+      EXPECT_TRUE((ConstMap(gyro.delta_velocity()) - v0).isApprox(
+                    ConstMap3(nominal.d_velocity_d_gyro_bias()) * db, 1e-3))
+        << "velocity, gyro bias " << k;
+      EXPECT_TRUE((ConstMap(gyro.delta_position()) - p0).isApprox(
+                    ConstMap3(nominal.d_position_d_gyro_bias()) * db, 1e-3))
+        << "position, gyro bias " << k;
+
+      Preintegrator accel;
+      accel.set_bias(zero, bias);
+      integrate_motion(accel);
+      EXPECT_TRUE((ConstMap(accel.delta_velocity()) - v0).isApprox(
+                    ConstMap3(nominal.d_velocity_d_accel_bias()) * db, 1e-6))
+        << "velocity, accel bias " << k;
+      EXPECT_TRUE((ConstMap(accel.delta_position()) - p0).isApprox(
+                    ConstMap3(nominal.d_position_d_accel_bias()) * db, 1e-6))
+        << "position, accel bias " << k;
+
+      // The rotation does not depend on the accelerometer bias
+      EXPECT_TRUE(ConstMap3(accel.delta_rotation()).isApprox(R0, 1e-12));
+    }
+}
+
+TEST(Preintegrator, CovarianceGrowsAsARandomWalkAtRest)
+{
+  const double gyro_noise = 1e-3, accel_noise = 2e-2;
+  Preintegrator preint(gyro_noise, accel_noise);
+  double w[3] = {0.0, 0.0, 0.0}, a[3] = {0.0, 0.0, 0.0};
+  for (int i = 0; i < steps; i++)
+    preint.integrate(w, a, dt);
+
+  Eigen::Map<const Eigen::Matrix<double, 9, 9, Eigen::RowMajor> > cov(preint.covariance());
+  double T = steps * dt;
+  EXPECT_TRUE(cov.isApprox(cov.transpose(), 1e-12));
+  for (int i = 0; i < 3; i++)
+    {
+      // Variance density times duration for rotation and velocity, T^3/3
+      // for position, up to the discretization
+      EXPECT_NEAR(gyro_noise * gyro_noise * T, cov(i, i), 1e-12);
+      EXPECT_NEAR(accel_noise * accel_noise * T, cov(3 + i, 3 + i), 1e-12);
+      EXPECT_NEAR(accel_noise * accel_noise * T * T * T / 3.0, cov(6 + i, 6 + i),
+                  0.01 * accel_noise * accel_noise * T * T * T / 3.0);
+    }
+}
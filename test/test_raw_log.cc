@@ -0,0 +1,110 @@
+// Raw log tests for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include <imu_3dm_gx3/raw_log.h>
+
+using namespace imu_3dm_gx3;
+
+// A fresh file name, removed again at the end of the test
+class RawLogTest : public ::testing::Test
+{
+protected:
+  void SetUp()
+  {
+    char name[] = "/tmp/imu_3dm_gx3_raw_log_XXXXXX";
+    int fd = mkstemp(name);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    path_ = name;
+  }
+
+  void TearDown() { unlink(path_.c_str()); }
+
+  std::string path_;
+};
+
+TEST_F(RawLogTest, RoundTripsHeaderAndRecords)
+{
+  RawLogHeader header;
+  header.preset = 0xCB;
+  header.t0 = 1234567890123456789LL;
+
+  std::vector<std::vector<unsigned char> > reads(3);
+  for (size_t i = 0; i < reads.size(); i++)
+    for (size_t j = 0; j < 10 * i + 1; j++)
+      reads[i].push_back((unsigned char)(7 * i + j));
+
+  RawLogWriter writer;
+  ASSERT_TRUE(writer.open(path_, header));
+  for (size_t i = 0; i < reads.size(); i++)
+    ASSERT_TRUE(writer.write(header.t0 + 1000 * i, &reads[i][0], reads[i].size()));
+  writer.close();
+
+  RawLogReader reader;
+  ASSERT_TRUE(reader.open(path_));
+  EXPECT_EQ(0xCB, reader.header().preset);
+  EXPECT_EQ(header.t0, reader.header().t0);
+
+  for (int pass = 0; pass < 2; pass++)
+    {
+      for (size_t i = 0; i < reads.size(); i++)
+        {
+          int64_t peeked = 0, received = 0;
+          const unsigned char *data = 0;
+          uint32_t length = 0;
+          ASSERT_TRUE(reader.peek(peeked));
+          ASSERT_TRUE(reader.next(received, data, length));
+          EXPECT_EQ(header.t0 + 1000 * (int64_t)i, received);
+          EXPECT_EQ(received, peeked);
+          ASSERT_EQ(reads[i].size(), length);
+          EXPECT_EQ(0, memcmp(&reads[i][0], data, length));
+        }
+      int64_t received;
+      const unsigned char *data;
+      uint32_t length;
+      EXPECT_FALSE(reader.next(received, data, length));
+      reader.rewind();
+    }
+}
+
+TEST_F(RawLogTest, StopsAtATruncatedRecord)
+{
+  RawLogHeader header;
+  header.preset = 0xCC;
+  header.t0 = 0;
+  const unsigned char bytes[100] = {0};
+
+  RawLogWriter writer;
+  ASSERT_TRUE(writer.open(path_, header));
+  ASSERT_TRUE(writer.write(1, bytes, sizeof(bytes)));
+  ASSERT_TRUE(writer.write(2, bytes, sizeof(bytes)));
+  writer.close();
+  ASSERT_EQ(0, truncate(path_.c_str(), 24 + 2 * (12 + 100) - 1));
+
+  RawLogReader reader;
+  ASSERT_TRUE(reader.open(path_));
+  int64_t received;
+  const unsigned char *data;
+  uint32_t length;
+  EXPECT_TRUE(reader.next(received, data, length));
+  EXPECT_FALSE(reader.next(received, data, length));
+}
+
+TEST_F(RawLogTest, RejectsOtherFiles)
+{
+  FILE *file = fopen(path_.c_str(), "wb");
+  ASSERT_TRUE(file != 0);
+  fputs("not a raw log, but long enough for a header", file);
+  fclose(file);
+
+  RawLogReader reader;
+  EXPECT_FALSE(reader.open(path_));
+  EXPECT_FALSE(reader.open(path_ + ".missing"));
+}
@@ -0,0 +1,117 @@
+// Dropped sample detection tests for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#include <gtest/gtest.h>
+#include <imu_3dm_gx3/sequence_tracker.h>
+
+using namespace imu_3dm_gx3;
+
+TEST(SequenceTracker, CountsLostSamples)
+{
+  SequenceTracker tracker(625.0);
+  EXPECT_EQ(SequenceTracker::FIRST, tracker.update(1000));
+  EXPECT_EQ(SequenceTracker::NEXT, tracker.update(1625));
+  EXPECT_EQ(1u, tracker.sequence());
+
+  // Three samples lost
+  EXPECT_EQ(SequenceTracker::GAP, tracker.update(1625 + 4 * 625));
+  EXPECT_EQ(5u, tracker.sequence());
+  EXPECT_EQ(3u, tracker.missed());
+
+  EXPECT_EQ(SequenceTracker::NEXT, tracker.update(1625 + 5 * 625));
+  EXPECT_EQ(0u, tracker.missed());
+  EXPECT_EQ(3u, tracker.dropped());
+  EXPECT_EQ(1u, tracker.gaps());
+}
+
+TEST(SequenceTracker, RecognizesRepeatedSamples)
+{
+  SequenceTracker tracker(625.0);
+  tracker.update(1000);
+  tracker.update(1625);
+  EXPECT_EQ(SequenceTracker::DUPLICATE, tracker.update(1625));
+  EXPECT_EQ(SequenceTracker::DUPLICATE, tracker.update(1700));
+  EXPECT_EQ(SequenceTracker::DUPLICATE, tracker.update(1000));
+  EXPECT_EQ(3u, tracker.duplicates());
+
+  // Duplicates neither advance the sequence nor move the reference
+  EXPECT_EQ(1u, tracker.sequence());
+  EXPECT_EQ(SequenceTracker::NEXT, tracker.update(2250));
+  EXPECT_EQ(2u, tracker.sequence());
+}
+
+TEST(SequenceTracker, RoundsPeriodsOfFractionalTicks)
+{
+  // 62500 ticks/s at 300 Hz give steps of 208 and 209 ticks
+  SequenceTracker tracker(62500.0 / 300.0);
+  uint64_t ticks = 0;
+  tracker.update(ticks);
+  for (int i = 0; i < 30; i++)
+    {
+      ticks += i % 3 == 0 ? 209 : 208;
+      EXPECT_EQ(SequenceTracker::NEXT, tracker.update(ticks)) << "step " << i;
+    }
+  EXPECT_EQ(0u, tracker.dropped());
+  EXPECT_EQ(30u, tracker.sequence());
+}
+
+TEST(SequenceTracker, LearnsThePeriod)
+{
+  SequenceTracker tracker;
+  uint64_t ticks = 0;
+  tracker.update(ticks);
+  // A drop while learning only lengthens that step
+  for (int i = 0; i < 8; i++)
+    {
+      ticks += i == 2 ? 3 * 625 : 625;
+      EXPECT_EQ(SequenceTracker::NEXT, tracker.update(ticks));
+    }
+  EXPECT_DOUBLE_EQ(625.0, tracker.expected());
+
+  EXPECT_EQ(SequenceTracker::GAP, tracker.update(ticks + 2 * 625));
+  EXPECT_EQ(1u, tracker.missed());
+}
+
+TEST(SequenceTracker, ContinuesAcrossARestart)
+{
+  SequenceTracker tracker(625.0);
+  tracker.update(50000);
+  tracker.update(50625);
+
+  // The device timer starts again from a small value
+  tracker.restart();
+  EXPECT_EQ(SequenceTracker::FIRST, tracker.update(100));
+  EXPECT_EQ(2u, tracker.sequence());
+  EXPECT_EQ(SequenceTracker::NEXT, tracker.update(725));
+  EXPECT_EQ(3u, tracker.sequence());
+  EXPECT_EQ(0u, tracker.dropped());
+  EXPECT_EQ(0u, tracker.duplicates());
+}
+
+TEST(SequenceTracker, TakesALongStepBackForARestart)
+{
+  // The timer of a device that browned out while streaming starts over
+  // without a restart() call
+  SequenceTracker tracker(625.0);
+  tracker.update(3600000000ull);
+  tracker.update(3600000625ull);
+  EXPECT_EQ(SequenceTracker::DUPLICATE, tracker.update(3600000000ull));
+
+  EXPECT_EQ(SequenceTracker::RESTART, tracker.update(2000));
+  EXPECT_EQ(2u, tracker.sequence());
+  EXPECT_EQ(2000u, tracker.ticks());
+  EXPECT_EQ(SequenceTracker::NEXT, tracker.update(2625));
+  EXPECT_EQ(3u, tracker.sequence());
+  EXPECT_EQ(0u, tracker.dropped());
+  EXPECT_EQ(1u, tracker.duplicates());
+}
+
+TEST(SequenceTracker, TakesALongStepBackForARestartWhileLearning)
+{
+  SequenceTracker tracker;
+  tracker.update(100000);
+  tracker.update(100625);
+  EXPECT_EQ(SequenceTracker::RESTART, tracker.update(500));
+  EXPECT_EQ(SequenceTracker::NEXT, tracker.update(1125));
+  EXPECT_EQ(3u, tracker.sequence());
+}
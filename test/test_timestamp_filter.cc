@@ -0,0 +1,129 @@
+// Clock estimation tests for the Microstrain 3DM-GX3-25 driver
+// N. Michael
+
+#include <cmath>
+#include <gtest/gtest.h>
+#include <imu_3dm_gx3/timestamp_filter.h>
+
+using namespace imu_3dm_gx3;
+
+// Transport delays as seen by the host: never below 'min' (s), mostly a
+// little above it and now and then a long stall
+class Delays
+{
+public:
+  Delays(double min) : min_(min), state_(12345), n_(0) {}
+
+  double next()
+  {
+    state_ = state_ * 1103515245u + 12345u;
+    double u = (state_ >> 8) / 16777216.0;
+    n_++;
+    return min_ + 2e-3 * u * u * u * u + (n_ % 37 == 0 ? 20e-3 : 0.0);
+  }
+
+private:
+  double min_;
+  uint32_t state_;
+  unsigned long n_;
+};
+
+TEST(TickUnwrapper, CarriesOverWraparound)
+{
+  TickUnwrapper ticks;
+  EXPECT_EQ(0xFFFFFF00ull, ticks.unwrap(0xFFFFFF00u));
+  EXPECT_EQ(0x100000010ull, ticks.unwrap(0x10u));
+  EXPECT_EQ(0x100000020ull, ticks.unwrap(0x20u));
+
+  ticks.reset();
+  EXPECT_EQ(0x30ull, ticks.unwrap(0x30u));
+}
+
+TEST(TickUnwrapper, SmallStepBackIsNoWrap)
+{
+  TickUnwrapper ticks;
+  ticks.unwrap(1000);
+  EXPECT_EQ(990ull, ticks.unwrap(990));
+  EXPECT_EQ(2000ull, ticks.unwrap(2000));
+  EXPECT_FALSE(ticks.restarted());
+}
+
+TEST(TickUnwrapper, LongStepBackIsARestart)
+{
+  // Up for a while and past a wrap when the device browns out
+  TickUnwrapper ticks;
+  ticks.unwrap(0xFFFFFF00u);
+  ticks.unwrap(0x00100000u);
+  EXPECT_EQ(0x100100000ull - 2500, ticks.unwrap(0x00100000u - 2500, 2500));
+  EXPECT_FALSE(ticks.restarted());
+
+  EXPECT_EQ(3000ull, ticks.unwrap(3000, 2500));
+  EXPECT_TRUE(ticks.restarted());
+  EXPECT_EQ(3625ull, ticks.unwrap(3625, 2500));
+  EXPECT_FALSE(ticks.restarted());
+}
+
+TEST(TimestampFilter, RecoversOffsetAndSkew)
+{
+  // Host clock 100 s ahead and 50 ppm fast, at least 1 ms of delay
+  const double offset = 100.0, skew = 50e-6, min_delay = 1e-3;
+  TimestampFilter filter(60.0, 0.5);
+  Delays delays(min_delay);
+
+  for (int i = 0; i < 3000; i++)
+    {
+      double device = i * 0.01;
+      double host = offset + device * (1.0 + skew) + delays.next();
+      double stamp = filter.update(device, host);
+      // Up to rounding of the offset correction
+      EXPECT_LE(stamp, host + 1e-9);
+    }
+
+  // The model follows the lower bound of the receive times, the clock
+  // relation shifted by the smallest delay
+  EXPECT_NEAR(skew, filter.skew(), 2e-6);
+  for (double device = 10.0; device < 30.0; device += 5.0)
+    EXPECT_NEAR(offset + device * (1.0 + skew) + min_delay, filter.host_time(device), 2e-4);
+}
+
+TEST(TimestampFilter, IgnoresStalls)
+{
+  // A long run of late samples moves nothing once the model is settled
+  TimestampFilter filter(60.0, 0.5);
+  Delays delays(1e-3);
+  double device = 0.0;
+  for (int i = 0; i < 2000; i++, device += 0.01)
+    filter.update(device, device + delays.next());
+  double before = filter.host_time(device);
+
+  for (int i = 0; i < 100; i++, device += 0.01)
+    filter.update(device, device + 0.05);
+  EXPECT_NEAR(before + 1.0, filter.host_time(device), 1e-4);
+}
+
+TEST(TimestampFilter, FollowsASkewChangeAfterTheWindow)
+{
+  // 50 ppm fast for the first 30 s, then 30 ppm slow; 30 s later the old
+  // part has left the 20 s window
+  TimestampFilter filter(20.0, 0.5);
+  Delays delays(1e-3);
+  for (int i = 0; i < 6000; i++)
+    {
+      double device = i * 0.01;
+      double drift = device < 30.0 ? device * 50e-6 : 30.0 * 50e-6 - (device - 30.0) * 30e-6;
+      filter.update(device, device + drift + delays.next());
+    }
+  EXPECT_NEAR(-30e-6, filter.skew(), 2e-6);
+}
+
+TEST(TimestampFilter, StartsFromTheFirstObservation)
+{
+  TimestampFilter filter;
+  EXPECT_DOUBLE_EQ(5.0, filter.update(1.0, 5.0));
+  // Within the first bucket the smallest offset is the estimate
+  EXPECT_DOUBLE_EQ(4.0 + 1.1, filter.update(1.1, 5.2));
+  EXPECT_DOUBLE_EQ(3.9 + 1.2, filter.update(1.2, 5.1));
+
+  filter.reset();
+  EXPECT_DOUBLE_EQ(7.0, filter.update(2.0, 7.0));
+}